@@ -0,0 +1,318 @@
+/* -*- mode: c; -*- */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <lastlog.h>
+#include <limits.h>
+#include <paths.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utmp.h>
+
+#include <sys/stat.h>
+
+#include "acct.h"
+#include "utils.h"
+
+/*
+ * utmp is opened once and kept open, workers inherit the descriptor. Each
+ * terminal's record is looked up when the terminal is set up, so that a
+ * login or a logout is a single pwrite() under a lock on that one record,
+ * instead of a scan of the whole file under a lock on all of it.
+ */
+static int utmp_fd = -1, lastlog_fd = -1;
+static char wtmp_path[PATH_MAX];
+
+static int
+lock_range(int fd, short type, off_t start, off_t len)
+{
+        struct flock fl;
+
+        memset(&fl, 0, sizeof fl);
+
+        fl.l_type = type;
+        fl.l_whence = SEEK_SET;
+        fl.l_start = start;
+        fl.l_len = len;
+
+        while (fcntl(fd, F_SETLKW, &fl)) {
+                if (EINTR != errno) {
+                        fprintf(stderr, "utmp lock : %s\n", strerror(errno));
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+static void
+unlock_range(int fd, off_t start, off_t len)
+{
+        struct flock fl;
+
+        memset(&fl, 0, sizeof fl);
+
+        fl.l_type = F_UNLCK;
+        fl.l_whence = SEEK_SET;
+        fl.l_start = start;
+        fl.l_len = len;
+
+        fcntl(fd, F_SETLK, &fl);
+}
+
+static int
+read_slot(struct acct_t *acct, struct utmp *ut)
+{
+        if (sizeof *ut != pread(utmp_fd, ut, sizeof *ut, acct->slot)) {
+                fprintf(stderr, "utmp read : %s\n", strerror(errno));
+                return 1;
+        }
+
+        return 0;
+}
+
+static int
+write_slot(struct acct_t *acct, const struct utmp *ut)
+{
+        int ret = 0;
+
+        if (lock_range(utmp_fd, F_WRLCK, acct->slot, sizeof *ut))
+                return 1;
+
+        if (sizeof *ut != pwrite(utmp_fd, ut, sizeof *ut, acct->slot)) {
+                fprintf(stderr, "utmp write : %s\n", strerror(errno));
+                ret = 1;
+        }
+
+        unlock_range(utmp_fd, acct->slot, sizeof *ut);
+
+        return ret;
+}
+
+static void
+fill_record(struct utmp *ut, struct acct_t *acct, short type)
+{
+        memset(ut, 0, sizeof *ut);
+
+        ut->ut_type = type;
+
+        strncpy(ut->ut_line, acct->line, sizeof ut->ut_line);
+        memcpy(ut->ut_id, acct->id, sizeof ut->ut_id);
+
+        ut->ut_tv.tv_sec = time(0);
+}
+
+static void
+append_wtmp(const struct utmp *ut)
+{
+        if (wtmp_path[0])
+                updwtmp(wtmp_path, ut);
+}
+
+/* a record left behind by a session whose logitty went away with it */
+static void
+reconcile(struct acct_t *acct, struct utmp *ut)
+{
+        if (USER_PROCESS != ut->ut_type ||
+            (0 < ut->ut_pid && (0 == kill(ut->ut_pid, 0) || EPERM == errno)))
+                return;
+
+        fprintf(stderr, "stale utmp entry for %.*s on %s, closing it\n",
+                (int)sizeof ut->ut_user, ut->ut_user, acct->line);
+
+        acct_logout(acct);
+}
+
+/*
+ * Opens the system's accounting files, or utmp, wtmp and lastlog in dir,
+ * created as needed, for testing. Without utmp there is no accounting but
+ * logins still go through.
+ */
+int acct_open(const char *dir)
+{
+        char buf[PATH_MAX];
+        const char *utmp_path = _PATH_UTMP, *lastlog_path = _PATH_LASTLOG;
+        int flags = O_RDWR | O_CLOEXEC, fd;
+
+        snprintf(wtmp_path, sizeof wtmp_path, "%s", _PATH_WTMP);
+
+        if (dir) {
+                flags |= O_CREAT;
+
+                snprintf(wtmp_path, sizeof wtmp_path, "%s/wtmp", dir);
+                if (0 <= (fd = open(wtmp_path, O_WRONLY | O_CREAT, 0644)))
+                        close(fd);
+
+                utmp_path = snprintf_(buf, sizeof buf, "%s/utmp", dir);
+                if (0 == utmp_path)
+                        return 1;
+        }
+
+        utmp_fd = open(utmp_path, flags, 0644);
+        if (0 > utmp_fd) {
+                fprintf(stderr, "open %s : %s\n", utmp_path, strerror(errno));
+                wtmp_path[0] = 0;
+                return 1;
+        }
+
+        if (dir) {
+                lastlog_path = snprintf_(buf, sizeof buf, "%s/lastlog", dir);
+                if (0 == lastlog_path)
+                        return 1;
+        }
+
+        /* it is not an error for the system to do without lastlog */
+        lastlog_fd = open(lastlog_path, flags, 0644);
+
+        return 0;
+}
+
+void acct_close()
+{
+        if (0 <= utmp_fd)
+                close(utmp_fd);
+
+        if (0 <= lastlog_fd)
+                close(lastlog_fd);
+
+        utmp_fd = lastlog_fd = -1;
+}
+
+/*
+ * Finds the record of the terminal fd, which is the one with its id like
+ * pututline() would, or adds one, and closes it if it is a leftover.
+ */
+void acct_prepare(struct acct_t *acct, int fd)
+{
+        struct utmp ut;
+        const char *s;
+        size_t n;
+        off_t off;
+
+        memset(acct, 0, sizeof *acct);
+        acct->slot = -1;
+
+        /* the line names the terminal in the event log, utmp or not */
+        if (0 == (s = ttyname(fd)) || strncmp(s, "/dev/", 5)) {
+                fprintf(stderr, "ttyname : %s\n", strerror(errno));
+                return;
+        }
+
+        s += 5;
+        snprintf(acct->line, sizeof acct->line, "%s", s);
+
+        /* tty2 is known as `2', pts/3 as `ts/3', like agetty has it */
+        if (0 == strncmp(s, "tty", 3) && '0' <= s[3] && s[3] <= '9')
+                s += 3;
+        else if ((n = strlen(s)) > sizeof acct->id)
+                s += n - sizeof acct->id;
+
+        strncpy(acct->id, s, sizeof acct->id);
+
+        if (0 > utmp_fd)
+                return;
+
+        if (lock_range(utmp_fd, F_WRLCK, 0, 0))
+                return;
+
+        for (off = 0;
+             sizeof ut == pread(utmp_fd, &ut, sizeof ut, off);
+             off += sizeof ut) {
+                if (INIT_PROCESS <= ut.ut_type && ut.ut_type <= DEAD_PROCESS &&
+                    0 == memcmp(ut.ut_id, acct->id, sizeof ut.ut_id)) {
+                        acct->slot = off;
+                        break;
+                }
+        }
+
+        if (0 > acct->slot) {
+                fill_record(&ut, acct, DEAD_PROCESS);
+
+                if (sizeof ut != pwrite(utmp_fd, &ut, sizeof ut, off)) {
+                        fprintf(stderr, "utmp write : %s\n", strerror(errno));
+                        unlock_range(utmp_fd, 0, 0);
+                        return;
+                }
+
+                acct->slot = off;
+        }
+
+        unlock_range(utmp_fd, 0, 0);
+
+        if (0 == read_slot(acct, &ut))
+                reconcile(acct, &ut);
+}
+
+int acct_login(struct acct_t *acct, const char *username, uid_t uid,
+               pid_t pid)
+{
+        struct lastlog ll;
+        struct utmp ut;
+
+        if (0 > utmp_fd || 0 > acct->slot)
+                return 0;
+
+        fill_record(&ut, acct, USER_PROCESS);
+
+        ut.ut_pid = pid;
+        strncpy(ut.ut_user, username, sizeof ut.ut_user);
+
+        if (write_slot(acct, &ut))
+                return 1;
+
+        append_wtmp(&ut);
+
+        if (0 <= lastlog_fd) {
+                memset(&ll, 0, sizeof ll);
+
+                ll.ll_time = ut.ut_tv.tv_sec;
+                strncpy(ll.ll_line, acct->line, sizeof ll.ll_line);
+
+                if (sizeof ll != pwrite(lastlog_fd, &ll, sizeof ll,
+                                        (off_t)uid * sizeof ll))
+                        fprintf(stderr, "lastlog : %s\n", strerror(errno));
+        }
+
+        return 0;
+}
+
+/*
+ * A session started again under another pid: the open record is given the
+ * new one, and wtmp has it from now on.
+ */
+void acct_update(struct acct_t *acct, pid_t pid)
+{
+        struct utmp ut;
+
+        if (0 > utmp_fd || 0 > acct->slot)
+                return;
+
+        if (read_slot(acct, &ut) || USER_PROCESS != ut.ut_type)
+                return;
+
+        ut.ut_pid = pid;
+
+        if (0 == write_slot(acct, &ut))
+                append_wtmp(&ut);
+}
+
+/* closes the terminal's record if it is still open, once */
+void acct_logout(struct acct_t *acct)
+{
+        struct utmp ut;
+
+        if (0 > utmp_fd || 0 > acct->slot)
+                return;
+
+        if (read_slot(acct, &ut) || USER_PROCESS != ut.ut_type)
+                return;
+
+        fill_record(&ut, acct, DEAD_PROCESS);
+
+        if (0 == write_slot(acct, &ut))
+                append_wtmp(&ut);
+}
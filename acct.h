@@ -0,0 +1,27 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_ACCT_H
+#define TUI_ACCT_H
+
+#include <sys/types.h>
+
+/*
+ * The utmp record of one terminal: where it lives in the file, found once
+ * when the terminal is set up, and what identifies it.
+ */
+struct acct_t {
+        off_t slot;
+        char line[32], id[4];
+};
+
+int acct_open(const char *dir);
+void acct_close();
+
+void acct_prepare(struct acct_t *acct, int fd);
+
+int acct_login(struct acct_t *acct, const char *username, uid_t uid,
+               pid_t pid);
+void acct_update(struct acct_t *acct, pid_t pid);
+void acct_logout(struct acct_t *acct);
+
+#endif /* TUI_ACCT_H */
@@ -0,0 +1,268 @@
+/* -*- mode: c; -*- */
+
+/*
+ * Drives logitty through a pseudo-terminal: logs in n times and reports the
+ * time from the Enter key to the start of the session.
+ *
+ *   driver [-n iterations] [-u user] -- logitty [args...]
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+static const char *exec_marker = "@@bench-exec ";
+static const char *fail_marker = "login failed";
+
+static char output[8192];
+static size_t outlen;
+
+static long long
+now()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+put(int fd, const char *s)
+{
+        if ((ssize_t)strlen(s) != write(fd, s, strlen(s))) {
+                fprintf(stderr, "write : %s\n", strerror(errno));
+                exit(1);
+        }
+}
+
+/*
+ * Reads whatever the terminal has for us within timeout ms; returns the
+ * number of bytes read, 0 on timeout, -1 once logitty is gone.
+ */
+static int
+pump(int fd, int timeout)
+{
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        ssize_t n;
+
+        if (0 >= poll(&pfd, 1, timeout))
+                return 0;
+
+        if (sizeof output - 1 - outlen < 1024) {
+                memmove(output, output + outlen / 2, outlen - outlen / 2);
+                outlen -= outlen / 2;
+        }
+
+        n = read(fd, output + outlen, sizeof output - 1 - outlen);
+        if (0 >= n)
+                return -1;
+
+        outlen += n;
+        output[outlen] = 0;
+
+        return n;
+}
+
+/* drops everything up to and including the marker just seen */
+static void
+consume(const char *p, size_t n)
+{
+        p += n;
+        outlen -= p - output;
+        memmove(output, p, outlen + 1);
+}
+
+static int
+cmp(const void *a, const void *b)
+{
+        long long x = *(const long long *)a, y = *(const long long *)b;
+        return x < y ? -1 : x > y;
+}
+
+static double
+percentile(long long *v, size_t n, double q)
+{
+        return v[(size_t)((n - 1) * q)] / 1e6;
+}
+
+/*
+ * Types n keys into the login field, one at a time, and reports how much
+ * the terminal had to be sent for each: bytes, and reads as a stand-in for
+ * the number of writes logitty has made.
+ */
+static int
+bench_keys(int fd, int n)
+{
+        static const char keys[] = "abcdefghij";
+        size_t bytes = 0, reads = 0, most = 0, b;
+        char key[2] = { 0, 0 };
+        int i, ret;
+
+        put(fd, "\t");
+
+        for (i = 0; i < n; ++i) {
+                /* ten keys in, ten backspaces out */
+                key[0] = i % 20 < 10 ? keys[i % 10] : 127;
+                put(fd, key);
+
+                for (b = 0; 0 < (ret = pump(fd, 20)); b += ret)
+                        ++reads;
+
+                if (0 > ret) {
+                        fprintf(stderr, "logitty has gone away\n");
+                        return 1;
+                }
+
+                bytes += b;
+                most = b > most ? b : most;
+                outlen = 0;
+        }
+
+        printf("keystrokes %d, bytes %zu, writes %zu\n", n, bytes, reads);
+        printf("per keystroke: %.1f bytes (max %zu), %.2f writes\n",
+               (double)bytes / n, most, (double)reads / n);
+
+        return 0;
+}
+
+static int
+bench_logins(int fd, int n, const char *user)
+{
+        long long t0, *lat;
+        size_t ok = 0, failed = 0;
+        int i, ret;
+        char *p;
+
+        if (0 == (lat = malloc(n * sizeof *lat)))
+                return 1;
+
+        put(fd, "\t");
+        put(fd, user);
+        put(fd, "\t");
+
+        /* the form keeps the login between attempts, not the password */
+        for (i = 0; i < n; ++i) {
+                put(fd, "pw");
+
+                /* settle, so that the form has echoed the keys */
+                while (0 < pump(fd, 20)) ;
+                outlen = 0;
+
+                t0 = now();
+                put(fd, "\n");
+
+                for (ret = 0; 0 <= ret; ) {
+                        if (0 > (ret = pump(fd, 5000)) || 0 == ret) {
+                                fprintf(stderr, "logitty stopped responding\n");
+                                goto out;
+                        }
+
+                        if ((p = strstr(output, exec_marker))) {
+                                lat[ok++] = strtoll(p + strlen(exec_marker),
+                                                    0, 10) - t0;
+                                consume(p, strlen(exec_marker));
+                                break;
+                        }
+
+                        if ((p = strstr(output, fail_marker))) {
+                                ++failed;
+                                consume(p, strlen(fail_marker));
+                                break;
+                        }
+                }
+
+                /* wait for the form to be back */
+                while (0 < pump(fd, 50)) ;
+        }
+
+out:
+        printf("iterations %d, sessions %zu, failed logins %zu\n",
+               n, ok, failed);
+
+        if (ok) {
+                qsort(lat, ok, sizeof *lat, cmp);
+                printf("enter to exec: min %.3f ms, p50 %.3f ms, "
+                       "p99 %.3f ms, max %.3f ms\n",
+                       lat[0] / 1e6, percentile(lat, ok, 0.50),
+                       percentile(lat, ok, 0.99), lat[ok - 1] / 1e6);
+        }
+
+        free(lat);
+
+        return ok + failed == (size_t)n ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+        struct passwd *pwd;
+        struct winsize ws = { 25, 80, 0, 0 };
+        const char *user = 0;
+        int c, fd, n = 100, keys = 0, ret;
+        pid_t pid;
+
+        while (-1 != (c = getopt(argc, argv, "kn:u:"))) {
+                switch (c) {
+                case 'k':
+                        keys = 1;
+                        break;
+
+                case 'n':
+                        n = atoi(optarg);
+                        break;
+
+                case 'u':
+                        user = optarg;
+                        break;
+
+                default:
+                        fprintf(stderr, "usage: driver [-k] [-n iterations] "
+                                "[-u user] -- logitty [args...]\n");
+                        return 1;
+                }
+        }
+
+        if (optind >= argc || 0 >= n)
+                return 1;
+
+        if (0 == user) {
+                if (0 == (pwd = getpwuid(getuid())))
+                        return 1;
+
+                user = pwd->pw_name;
+        }
+
+        setenv("TERM", "linux", 1);
+
+        pid = forkpty(&fd, 0, 0, &ws);
+        if (0 > pid) {
+                fprintf(stderr, "forkpty : %s\n", strerror(errno));
+                return 1;
+        }
+
+        if (0 == pid) {
+                execv(argv[optind], argv + optind);
+                _exit(127);
+        }
+
+        /* let the form come up */
+        while (0 < pump(fd, 200)) ;
+
+        if (keys)
+                ret = bench_keys(fd, n);
+        else
+                ret = bench_logins(fd, n, user);
+
+        kill(pid, SIGTERM);
+        waitpid(pid, 0, 0);
+
+        return ret;
+}
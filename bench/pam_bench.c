@@ -0,0 +1,96 @@
+/* -*- mode: c; -*- */
+
+/*
+ * A PAM module for benchmarking: authentication takes delay=<ms> and fails
+ * fail=<percent> of the time, everything else succeeds at once.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <security/pam_modules.h>
+
+#define UNUSED(x) ((void)(x))
+
+static void
+parse_args(int argc, const char **argv, long *delay, int *fail)
+{
+        int i;
+
+        *delay = 0;
+        *fail = 0;
+
+        for (i = 0; i < argc; ++i) {
+                if (0 == strncmp(argv[i], "delay=", 6))
+                        *delay = strtol(argv[i] + 6, 0, 10);
+                else if (0 == strncmp(argv[i], "fail=", 5))
+                        *fail = strtol(argv[i] + 5, 0, 10);
+        }
+}
+
+PAM_EXTERN int
+pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, const char **argv)
+{
+        struct timespec ts;
+        const char *user, *authtok;
+        unsigned seed;
+        long delay;
+        int fail;
+
+        UNUSED(flags);
+
+        parse_args(argc, argv, &delay, &fail);
+
+        if (PAM_SUCCESS != pam_get_user(pamh, &user, 0) ||
+            PAM_SUCCESS != pam_get_authtok(pamh, PAM_AUTHTOK, &authtok, 0))
+                return PAM_AUTH_ERR;
+
+        if (delay > 0) {
+                ts.tv_sec = delay / 1000;
+                ts.tv_nsec = delay % 1000 * 1000000L;
+
+                while (nanosleep(&ts, &ts))
+                        ;
+        }
+
+        if (fail > 0) {
+                clock_gettime(CLOCK_REALTIME, &ts);
+                seed = ts.tv_nsec ^ getpid();
+
+                if (rand_r(&seed) % 100 < fail)
+                        return PAM_AUTH_ERR;
+        }
+
+        return PAM_SUCCESS;
+}
+
+PAM_EXTERN int
+pam_sm_setcred(pam_handle_t *pamh, int flags, int argc, const char **argv)
+{
+        UNUSED(pamh);
+        UNUSED(flags);
+        UNUSED(argc);
+        UNUSED(argv);
+
+        return PAM_SUCCESS;
+}
+
+PAM_EXTERN int
+pam_sm_acct_mgmt(pam_handle_t *pamh, int flags, int argc, const char **argv)
+{
+        return pam_sm_setcred(pamh, flags, argc, argv);
+}
+
+PAM_EXTERN int
+pam_sm_open_session(pam_handle_t *pamh, int flags, int argc, const char **argv)
+{
+        return pam_sm_setcred(pamh, flags, argc, argv);
+}
+
+PAM_EXTERN int
+pam_sm_close_session(pam_handle_t *pamh, int flags, int argc, const char **argv)
+{
+        return pam_sm_setcred(pamh, flags, argc, argv);
+}
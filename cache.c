@@ -0,0 +1,202 @@
+/* -*- mode: c; -*- */
+
+#include <crypt.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "cache.h"
+
+/*
+ * Verifiers of recently authenticated users, kept by the long-running
+ * logitty so that a relogin can be checked locally instead of going through
+ * the whole auth stack again. A verifier is a salted yescrypt hash of the
+ * password, made by the worker that has just authenticated the user: the
+ * password itself never reaches this process.
+ *
+ * The table is locked in memory, left out of core dumps and wiped in the
+ * children, workers and sessions alike. Entries expire ttl seconds after
+ * the authentication they come from, time spent suspended included.
+ */
+#define CACHE_SIZE 64
+
+struct entry_t {
+        char username[32];
+        char verifier[CACHE_VERIFIER_SIZE];
+        time_t expires;
+};
+
+static struct entry_t *entries;
+static int cache_ttl;
+
+static time_t
+now()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_BOOTTIME, &ts);
+
+        return ts.tv_sec;
+}
+
+static void
+wipe(struct entry_t *e)
+{
+        explicit_bzero(e, sizeof *e);
+}
+
+int cache_setup(int ttl)
+{
+        size_t size = CACHE_SIZE * sizeof *entries;
+        void *p;
+
+        if (geteuid()) {
+                fprintf(stderr, "credential cache : only for root\n");
+                return 1;
+        }
+
+        p = mmap(0, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == p) {
+                fprintf(stderr, "credential cache : %s\n", strerror(errno));
+                return 1;
+        }
+
+        if (mlock(p, size) ||
+            madvise(p, size, MADV_DONTDUMP) ||
+            madvise(p, size, MADV_WIPEONFORK)) {
+                fprintf(stderr, "credential cache : %s\n", strerror(errno));
+                munmap(p, size);
+                return 1;
+        }
+
+        entries = p;
+        cache_ttl = ttl;
+
+        return 0;
+}
+
+int cache_enabled()
+{
+        return 0 != entries;
+}
+
+static struct entry_t *
+lookup(const char *username)
+{
+        int i;
+
+        for (i = 0; i < CACHE_SIZE; ++i) {
+                if (entries[i].expires &&
+                    0 == strcmp(entries[i].username, username))
+                        return entries + i;
+        }
+
+        return 0;
+}
+
+const char *cache_find(const char *username)
+{
+        struct entry_t *e;
+
+        if (0 == entries || 0 == (e = lookup(username)))
+                return 0;
+
+        if (e->expires <= now()) {
+                wipe(e);
+                return 0;
+        }
+
+        return e->verifier;
+}
+
+void cache_store(const char *username, const char *verifier)
+{
+        struct entry_t *e;
+        int i;
+
+        if (0 == entries ||
+            sizeof e->username <= strlen(username) ||
+            sizeof e->verifier <= strlen(verifier))
+                return;
+
+        /* the user's own entry, a free one, or the one closest to expiry */
+        if (0 == (e = lookup(username))) {
+                e = entries;
+                for (i = 1; i < CACHE_SIZE && e->expires; ++i) {
+                        if (entries[i].expires < e->expires)
+                                e = entries + i;
+                }
+        }
+
+        wipe(e);
+
+        strcpy(e->username, username);
+        strcpy(e->verifier, verifier);
+        e->expires = now() + cache_ttl;
+}
+
+void cache_forget(const char *username)
+{
+        struct entry_t *e;
+
+        if (entries && (e = lookup(username)))
+                wipe(e);
+}
+
+/**********************************************************************/
+
+/* these two run in the worker */
+
+int cache_make(const char *password, char *verifier)
+{
+        struct crypt_data data;
+        char setting[CRYPT_GENSALT_OUTPUT_SIZE];
+        const char *hash;
+        int ret = 1;
+
+        memset(&data, 0, sizeof data);
+
+        if (0 == crypt_gensalt_rn("$y$", 0, 0, 0, setting, sizeof setting) ||
+            0 == (hash = crypt_rn(password, setting, &data, sizeof data)) ||
+            '*' == *hash ||
+            CACHE_VERIFIER_SIZE <= strlen(hash)) {
+                fprintf(stderr, "credential cache : %s\n", strerror(errno));
+                goto out;
+        }
+
+        strcpy(verifier, hash);
+        ret = 0;
+
+out:
+        explicit_bzero(&data, sizeof data);
+
+        return ret;
+}
+
+int cache_check(const char *password, const char *verifier)
+{
+        struct crypt_data data;
+        const char *hash;
+        unsigned char diff = 0;
+        size_t i, n;
+
+        memset(&data, 0, sizeof data);
+
+        hash = crypt_rn(password, verifier, &data, sizeof data);
+
+        if (hash && '*' != *hash && (n = strlen(verifier)) == strlen(hash)) {
+                for (i = 0; i < n; ++i)
+                        diff |= hash[i] ^ verifier[i];
+        }
+        else
+                diff = 1;
+
+        explicit_bzero(&data, sizeof data);
+
+        return 0 == diff;
+}
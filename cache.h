@@ -0,0 +1,19 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_CACHE_H
+#define TUI_CACHE_H
+
+/* a yescrypt string, with room to spare */
+#define CACHE_VERIFIER_SIZE 128
+
+int cache_setup(int ttl);
+int cache_enabled();
+
+const char *cache_find(const char *username);
+void cache_store(const char *username, const char *verifier);
+void cache_forget(const char *username);
+
+int cache_make(const char *password, char *verifier);
+int cache_check(const char *password, const char *verifier);
+
+#endif /* TUI_CACHE_H */
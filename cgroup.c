@@ -0,0 +1,294 @@
+/* -*- mode: c; -*- */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "cgroup.h"
+
+const char *cgroup_keys[] = {
+        "cpu.weight",
+        "memory.high",
+        0
+};
+
+static int root_fd = -1;
+
+static int
+write_file(int dir, const char *file, const char *value)
+{
+        ssize_t n;
+        int fd;
+
+        if (0 > (fd = openat(dir, file, O_WRONLY | O_CLOEXEC)))
+                return 1;
+
+        n = write(fd, value, strlen(value));
+        close(fd);
+
+        return (ssize_t)strlen(value) != n;
+}
+
+static int
+read_file(int dir, const char *file, char *buf, size_t len)
+{
+        ssize_t n;
+        int fd;
+
+        if (0 > (fd = openat(dir, file, O_RDONLY | O_CLOEXEC)))
+                return 1;
+
+        n = read(fd, buf, len - 1);
+        close(fd);
+
+        if (0 > n)
+                return 1;
+
+        buf[n] = 0;
+
+        return 0;
+}
+
+/* the value of key in a flat-keyed file like cpu.stat, summed over lines */
+static unsigned long long
+stat_value(const char *buf, const char *key)
+{
+        unsigned long long sum = 0;
+        const char *p;
+        size_t n = strlen(key);
+
+        for (p = buf; (p = strstr(p, key)); p += n) {
+                if ((p == buf || ' ' == p[-1] || '\n' == p[-1]) &&
+                    ('=' == p[n] || ' ' == p[n]))
+                        sum += strtoull(p + n + 1, 0, 10);
+        }
+
+        return sum;
+}
+
+/* tty2 has its session in <root>/tty2, pts/3 in <root>/pts-3 */
+static int
+cgroup_name(char *buf, size_t len, int tty)
+{
+        const char *s;
+        char *p;
+
+        if (0 == (s = ttyname(tty)) || strncmp(s, "/dev/", 5))
+                return 1;
+
+        snprintf(buf, len, "%s", s + 5);
+
+        for (p = buf; *p; ++p)
+                if ('/' == *p)
+                        *p = '-';
+
+        return 0;
+}
+
+static void
+report(int dir, const char *name, const char *username)
+{
+        char buf[1024];
+        unsigned long long usage, user, sys, peak = 0, rd = 0, wr = 0;
+
+        if (read_file(dir, "cpu.stat", buf, sizeof buf))
+                return;
+
+        usage = stat_value(buf, "usage_usec");
+        user = stat_value(buf, "user_usec");
+        sys = stat_value(buf, "system_usec");
+
+        if (0 == read_file(dir, "memory.peak", buf, sizeof buf))
+                peak = strtoull(buf, 0, 10);
+
+        if (0 == read_file(dir, "io.stat", buf, sizeof buf)) {
+                rd = stat_value(buf, "rbytes");
+                wr = stat_value(buf, "wbytes");
+        }
+
+        fprintf(stderr, "session user=%s tty=%s cpu=%llu.%06llus "
+                "user=%llu.%06llus system=%llu.%06llus memory.peak=%lluK "
+                "io.read=%lluK io.write=%lluK\n",
+                username, name,
+                usage / 1000000, usage % 1000000,
+                user / 1000000, user % 1000000,
+                sys / 1000000, sys % 1000000,
+                peak / 1024, rd / 1024, wr / 1024);
+}
+
+/* SIGKILL to each process in the cgroup, for kernels without cgroup.kill */
+static void
+kill_procs(int dir)
+{
+        FILE *f;
+        int fd, pid;
+
+        if (0 > (fd = openat(dir, "cgroup.procs", O_RDONLY | O_CLOEXEC)))
+                return;
+
+        if (0 == (f = fdopen(fd, "r"))) {
+                close(fd);
+                return;
+        }
+
+        while (1 == fscanf(f, "%d", &pid))
+                kill(pid, SIGKILL);
+
+        fclose(f);
+}
+
+/* kills whatever is left in the cgroup and waits for it to be empty */
+static void
+kill_all(int dir)
+{
+        struct pollfd pfd;
+        char buf[256];
+        ssize_t n;
+        int i, one_by_one = 0;
+
+        if (write_file(dir, "cgroup.kill", "1")) {
+                fprintf(stderr, "cgroup.kill : %s, killing one by one\n",
+                        strerror(errno));
+                one_by_one = 1;
+        }
+
+        if (0 > (pfd.fd = openat(dir, "cgroup.events", O_RDONLY | O_CLOEXEC)))
+                return;
+
+        pfd.events = POLLPRI;
+
+        /* cgroup.events is notified when populated changes */
+        for (i = 0; i < 50; ++i) {
+                if (0 > (n = pread(pfd.fd, buf, sizeof buf - 1, 0)))
+                        break;
+
+                buf[n] = 0;
+                if (strstr(buf, "populated 0"))
+                        break;
+
+                /* again, for what has forked in the meantime */
+                if (one_by_one)
+                        kill_procs(dir);
+
+                poll(&pfd, 1, 100);
+        }
+
+        close(pfd.fd);
+}
+
+/*
+ * Creates root if needed and hands the controllers down to the session
+ * cgroups; those that are not available are done without.
+ */
+int cgroup_setup(const char *root)
+{
+        static const char *controllers[] = { "+cpu", "+memory", "+io", 0 };
+        const char **pp;
+
+        if (mkdir(root, 0755) && EEXIST != errno) {
+                fprintf(stderr, "mkdir %s : %s\n", root, strerror(errno));
+                return 1;
+        }
+
+        root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (0 > root_fd) {
+                fprintf(stderr, "open %s : %s\n", root, strerror(errno));
+                return 1;
+        }
+
+        for (pp = controllers; *pp; ++pp) {
+                if (write_file(root_fd, "cgroup.subtree_control", *pp))
+                        fprintf(stderr, "%s : cannot enable %s : %s\n",
+                                root, *pp + 1, strerror(errno));
+        }
+
+        return 0;
+}
+
+/*
+ * Creates the cgroup of the session on tty and applies the limits, a list
+ * of key, value pairs. Without a root, or on failure, cg->dir is -1 and the
+ * session runs where logitty does.
+ */
+int cgroup_open(struct cgroup_t *cg, int tty, char **limits)
+{
+        memset(cg, 0, sizeof *cg);
+        cg->dir = -1;
+
+        if (0 > root_fd)
+                return 0;
+
+        if (cgroup_name(cg->name, sizeof cg->name, tty))
+                return 1;
+
+        /* a leftover from a session that was not cleaned up */
+        if (0 == faccessat(root_fd, cg->name, F_OK, 0))
+                cgroup_reap(tty);
+
+        if (mkdirat(root_fd, cg->name, 0755) ||
+            0 > (cg->dir = openat(root_fd, cg->name,
+                                  O_RDONLY | O_DIRECTORY | O_CLOEXEC))) {
+                fprintf(stderr, "cgroup %s : %s\n", cg->name, strerror(errno));
+                return 1;
+        }
+
+        for (; limits && limits[0]; limits += 2) {
+                if (write_file(cg->dir, limits[0], limits[1]))
+                        fprintf(stderr, "cgroup %s : %s = %s : %s\n",
+                                cg->name, limits[0], limits[1],
+                                strerror(errno));
+        }
+
+        return 0;
+}
+
+/* kills what a failed session has left, before it is started again */
+void cgroup_clear(struct cgroup_t *cg)
+{
+        if (0 <= cg->dir)
+                kill_all(cg->dir);
+}
+
+/* ends the session for good, logs what it has cost and removes the cgroup */
+void cgroup_close(struct cgroup_t *cg, const char *username)
+{
+        if (0 > cg->dir)
+                return;
+
+        kill_all(cg->dir);
+
+        if (username)
+                report(cg->dir, cg->name, username);
+
+        close(cg->dir);
+
+        if (unlinkat(root_fd, cg->name, AT_REMOVEDIR))
+                fprintf(stderr, "cgroup %s : %s\n", cg->name, strerror(errno));
+
+        cg->dir = -1;
+}
+
+/* cleans up after a worker that has gone without closing its cgroup */
+void cgroup_reap(int tty)
+{
+        struct cgroup_t cg;
+
+        if (0 > root_fd)
+                return;
+
+        memset(&cg, 0, sizeof cg);
+
+        if (cgroup_name(cg.name, sizeof cg.name, tty))
+                return;
+
+        cg.dir = openat(root_fd, cg.name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (0 <= cg.dir)
+                cgroup_close(&cg, "?");
+}
@@ -0,0 +1,27 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_CGROUP_H
+#define TUI_CGROUP_H
+
+/*
+ * Each session runs in a cgroup of its own, named after its terminal, under
+ * a root given with -g. The session child is forked straight into it from
+ * dir, and at logout everything left in it is killed.
+ */
+struct cgroup_t {
+        int dir;
+        char name[32];
+};
+
+/* the startup entry keys that are written to the session's cgroup */
+extern const char *cgroup_keys[];
+
+int cgroup_setup(const char *root);
+
+int cgroup_open(struct cgroup_t *cg, int tty, char **limits);
+void cgroup_clear(struct cgroup_t *cg);
+void cgroup_close(struct cgroup_t *cg, const char *username);
+
+void cgroup_reap(int tty);
+
+#endif /* TUI_CGROUP_H */
@@ -0,0 +1,152 @@
+/* -*- mode: c; -*- */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "events.h"
+
+_Static_assert(TRACE_PHASES <= EVENT_PHASES, "too many trace phases");
+_Static_assert(sizeof(struct events_header_t) <= EVENTS_HEADER_SIZE,
+               "event log header too large");
+
+static int events_fd = -1;
+static struct events_header_t *header;
+
+/* a new log: the header, then every record's place, zeroed */
+static int
+make_log(int fd, unsigned capacity)
+{
+        struct events_header_t h;
+        int err;
+
+        memset(&h, 0, sizeof h);
+        memcpy(h.magic, EVENTS_MAGIC, sizeof h.magic);
+        h.size = sizeof(struct event_t);
+        h.capacity = capacity;
+
+        if (sizeof h != pwrite(fd, &h, sizeof h, 0))
+                return errno;
+
+        if ((err = posix_fallocate(fd, 0, EVENTS_HEADER_SIZE +
+                                   (off_t)capacity * h.size)))
+                return err;
+
+        return 0;
+}
+
+/*
+ * Opens the event log at path, or makes one of capacity records. An
+ * existing log keeps its own capacity.
+ */
+int events_open(const char *path, unsigned capacity)
+{
+        struct events_header_t *h;
+        struct stat st;
+        int fd, err;
+
+        if (0 > (fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640))) {
+                fprintf(stderr, "event log : %s : %s\n", path,
+                        strerror(errno));
+                return 1;
+        }
+
+        if (fstat(fd, &st)) {
+                err = errno;
+                goto err;
+        }
+
+        if (0 == st.st_size && (err = make_log(fd, capacity)))
+                goto err;
+
+        h = mmap(0, EVENTS_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+        if (MAP_FAILED == h) {
+                err = errno;
+                goto err;
+        }
+
+        if (fstat(fd, &st) ||
+            memcmp(h->magic, EVENTS_MAGIC, sizeof h->magic) ||
+            sizeof(struct event_t) != h->size || 0 == h->capacity ||
+            st.st_size < EVENTS_HEADER_SIZE + (off_t)h->capacity * h->size) {
+                fprintf(stderr, "event log : %s : not an event log\n", path);
+                munmap(h, EVENTS_HEADER_SIZE);
+                close(fd);
+                return 1;
+        }
+
+        events_fd = fd;
+        header = h;
+
+        return 0;
+
+err:
+        fprintf(stderr, "event log : %s : %s\n", path, strerror(err));
+        close(fd);
+
+        return 1;
+}
+
+void events_close()
+{
+        if (0 > events_fd)
+                return;
+
+        munmap(header, EVENTS_HEADER_SIZE);
+        close(events_fd);
+
+        events_fd = -1;
+        header = 0;
+}
+
+int events_enabled()
+{
+        return 0 <= events_fd;
+}
+
+/*
+ * Appends an event: the record is filled in without any formatting and
+ * written in one go to its slot.
+ */
+void events_log(enum event_type_t type, const char *tty, const char *user,
+                uid_t uid, int status, const unsigned int *phases)
+{
+        struct event_t ev;
+        struct timespec ts;
+        off_t off;
+
+        if (0 > events_fd)
+                return;
+
+        memset(&ev, 0, sizeof ev);
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+
+        ev.seq = __atomic_fetch_add(&header->next, 1, __ATOMIC_RELAXED);
+        ev.time = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        ev.uid = uid;
+        ev.pid = getpid();
+        ev.status = status;
+        ev.type = type;
+        ev.nphases = TRACE_PHASES;
+
+        if (tty)
+                strncpy(ev.tty, tty, sizeof ev.tty - 1);
+        if (user)
+                strncpy(ev.user, user, sizeof ev.user - 1);
+        if (phases)
+                memcpy(ev.phases, phases, TRACE_PHASES * sizeof *phases);
+
+        off = EVENTS_HEADER_SIZE +
+                (off_t)(ev.seq % header->capacity) * sizeof ev;
+
+        if (sizeof ev != pwrite(events_fd, &ev, sizeof ev, off))
+                fprintf(stderr, "event log : %s\n", strerror(errno));
+}
@@ -0,0 +1,61 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_EVENTS_H
+#define TUI_EVENTS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "trace.h"
+
+/*
+ * The event log: fixed-size binary records in a ring file made to size up
+ * front, one pwrite() each. A header page holds the sequence number of the
+ * next record, which every process appending to the file takes with an
+ * atomic increment on its shared mapping; record seq lives in slot
+ * seq % capacity. tools/logitty-events turns the file into text or JSON.
+ */
+#define EVENTS_MAGIC "LGTYEV01"
+#define EVENTS_HEADER_SIZE 4096
+
+/* room for every trace phase, and then some */
+#define EVENT_PHASES 16
+
+enum event_type_t {
+        EVENT_LOGIN = 1,
+        EVENT_FAILURE,
+        EVENT_LOGOUT,
+};
+
+struct events_header_t {
+        char magic[8];
+        uint32_t size, capacity;
+        uint64_t next;
+};
+
+/*
+ * status is the PAM status of a failure, -1 when the session could not be
+ * started, and for a logout the session's exit status, or 128 and the
+ * signal that has killed it. uid is -1 for a user who is not known.
+ * Phases are in microseconds, in the order of trace.h, all 0 in a build
+ * without tracing.
+ */
+struct event_t {
+        uint64_t seq;
+        int64_t time;
+        uint32_t uid;
+        int32_t pid, status;
+        uint16_t type, nphases;
+        char tty[32];
+        char user[32];
+        uint32_t phases[EVENT_PHASES];
+};
+
+int events_open(const char *path, unsigned capacity);
+void events_close();
+int events_enabled();
+
+void events_log(enum event_type_t type, const char *tty, const char *user,
+                uid_t uid, int status, const unsigned int *phases);
+
+#endif /* TUI_EVENTS_H */
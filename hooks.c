@@ -0,0 +1,265 @@
+/* -*- mode: c; -*- */
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/wait.h>
+
+#include "hooks.h"
+#include "launch.h"
+
+/* as many as there are bits in a hook's dependencies */
+#define MAX_HOOKS 32
+
+enum { HOOK_WAITING, HOOK_RUNNING, HOOK_DONE, HOOK_FAILED };
+
+struct hook_t {
+        char name[32], deps[128];
+        const char *command;
+
+        /* bits of the hooks this one comes after */
+        uint32_t after;
+
+        long long timeout, start;
+        pid_t pid;
+        int state;
+};
+
+static long long
+now_ms()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* name [after=a,b] [timeout=seconds]: command */
+static int
+parse_hook(struct hook_t *h, const char *spec)
+{
+        char buf[256], *tok, *save;
+        const char *p;
+
+        memset(h, 0, sizeof *h);
+        h->timeout = HOOK_TIMEOUT * 1000;
+
+        if (0 == (p = strchr(spec, ':')) || (size_t)(p - spec) >= sizeof buf) {
+                fprintf(stderr, "hook : bad hook %s\n", spec);
+                return 1;
+        }
+
+        memcpy(buf, spec, p - spec);
+        buf[p - spec] = 0;
+
+        for (h->command = p + 1; ' ' == *h->command; ++h->command) ;
+
+        if (0 == (tok = strtok_r(buf, " \t", &save)) || 0 == *h->command) {
+                fprintf(stderr, "hook : bad hook %s\n", spec);
+                return 1;
+        }
+
+        snprintf(h->name, sizeof h->name, "%s", tok);
+
+        while ((tok = strtok_r(0, " \t", &save))) {
+                if (0 == strncmp(tok, "after=", 6))
+                        snprintf(h->deps, sizeof h->deps, "%s", tok + 6);
+                else if (0 == strncmp(tok, "timeout=", 8))
+                        h->timeout = strtod(tok + 8, 0) * 1000;
+                else {
+                        fprintf(stderr, "hook : %s : unknown option %s\n",
+                                h->name, tok);
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+/* turns the names of what each hook comes after into bits */
+static void
+resolve(struct hook_t *hooks, size_t n)
+{
+        char *tok, *save;
+        size_t i, j;
+
+        for (i = 0; i < n; ++i) {
+                for (tok = strtok_r(hooks[i].deps, ",", &save); tok;
+                     tok = strtok_r(0, ",", &save)) {
+                        for (j = 0; j < n && strcmp(hooks[j].name, tok); ++j) ;
+
+                        if (j == n) {
+                                fprintf(stderr, "hook : %s : no hook %s\n",
+                                        hooks[i].name, tok);
+                                hooks[i].state = HOOK_FAILED;
+                                break;
+                        }
+
+                        hooks[i].after |= 1u << j;
+                }
+        }
+}
+
+static void
+finish(struct hook_t *h, int status, long long t)
+{
+        if (WIFEXITED(status) && 0 == WEXITSTATUS(status)) {
+                h->state = HOOK_DONE;
+                fprintf(stderr, "hook : %s done in %lldms\n",
+                        h->name, t - h->start);
+                return;
+        }
+
+        h->state = HOOK_FAILED;
+
+        if (WIFEXITED(status))
+                fprintf(stderr, "hook : %s failed with %d after %lldms\n",
+                        h->name, WEXITSTATUS(status), t - h->start);
+        else
+                fprintf(stderr, "hook : %s killed by signal %d after %lldms\n",
+                        h->name, WTERMSIG(status), t - h->start);
+}
+
+/*
+ * Starts whatever hook has all it comes after done, and gives up on those
+ * that come after a failed one. Returns the number running.
+ */
+static int
+start_hooks(struct launch_t *l, struct hook_t *hooks, size_t n)
+{
+        uint32_t done = 0, failed = 0;
+        size_t i;
+        int running, changed;
+
+        do {
+                changed = running = 0;
+
+                for (i = 0; i < n; ++i) {
+                        if (HOOK_DONE == hooks[i].state)
+                                done |= 1u << i;
+                        else if (HOOK_FAILED == hooks[i].state)
+                                failed |= 1u << i;
+                }
+
+                for (i = 0; i < n; ++i) {
+                        struct hook_t *h = hooks + i;
+
+                        if (HOOK_RUNNING == h->state)
+                                ++running;
+
+                        if (HOOK_WAITING != h->state)
+                                continue;
+
+                        if (h->after & failed) {
+                                fprintf(stderr, "hook : %s skipped\n",
+                                        h->name);
+                                h->state = HOOK_FAILED;
+                                changed = 1;
+                        }
+                        else if ((h->after & done) == h->after) {
+                                h->start = now_ms();
+                                h->pid = launch_command(l, h->command);
+                                h->state = 0 < h->pid ?
+                                        HOOK_RUNNING : HOOK_FAILED;
+                                changed = 1;
+                        }
+                }
+        } while (changed);
+
+        return running;
+}
+
+/**********************************************************************/
+
+void run_hooks(struct launch_t *l, char **specs, int deadline)
+{
+        struct hook_t hooks[MAX_HOOKS];
+        struct timespec ts;
+        sigset_t mask, saved;
+        long long t0, end, t, wait;
+        size_t i, n = 0;
+        int status;
+
+        for (; *specs; ++specs) {
+                if (MAX_HOOKS == n) {
+                        fprintf(stderr, "hook : more than %d hooks\n",
+                                MAX_HOOKS);
+                        break;
+                }
+
+                if (0 == parse_hook(hooks + n, *specs))
+                        ++n;
+        }
+
+        if (0 == n)
+                return;
+
+        resolve(hooks, n);
+
+        /* the hooks' exits are waited for with a timeout */
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &mask, &saved);
+
+        t0 = now_ms();
+        end = t0 + deadline * 1000LL;
+
+        while (start_hooks(l, hooks, n)) {
+                t = now_ms();
+                wait = end - t;
+
+                for (i = 0; i < n; ++i) {
+                        if (HOOK_RUNNING == hooks[i].state &&
+                            hooks[i].start + hooks[i].timeout - t < wait)
+                                wait = hooks[i].start + hooks[i].timeout - t;
+                }
+
+                if (0 < wait) {
+                        ts.tv_sec = wait / 1000;
+                        ts.tv_nsec = wait % 1000 * 1000000;
+                        sigtimedwait(&mask, 0, &ts);
+                }
+
+                t = now_ms();
+
+                for (i = 0; i < n; ++i) {
+                        struct hook_t *h = hooks + i;
+
+                        if (HOOK_RUNNING != h->state)
+                                continue;
+
+                        if (h->pid == waitpid(h->pid, &status, WNOHANG)) {
+                                finish(h, status, t);
+                                continue;
+                        }
+
+                        if (t < end && t < h->start + h->timeout)
+                                continue;
+
+                        kill(h->pid, SIGKILL);
+                        waitpid(h->pid, 0, 0);
+
+                        h->state = HOOK_FAILED;
+                        fprintf(stderr, "hook : %s timed out after %lldms\n",
+                                h->name, t - h->start);
+                }
+
+                if (t >= end)
+                        break;
+        }
+
+        /* past the deadline, or waiting on each other */
+        for (i = 0; i < n; ++i) {
+                if (HOOK_WAITING == hooks[i].state)
+                        fprintf(stderr, "hook : %s not run\n", hooks[i].name);
+        }
+
+        sigprocmask(SIG_SETMASK, &saved, 0);
+
+        fprintf(stderr, "hook : all done in %lldms\n", now_ms() - t0);
+}
@@ -0,0 +1,24 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_HOOKS_H
+#define TUI_HOOKS_H
+
+struct launch_t;
+
+/*
+ * Commands run before the session, each one a hook line of the entry:
+ *
+ *   hook = audio: pipewire-setup
+ *   hook = gestures after=audio timeout=2: libinput-gestures-setup start
+ *
+ * Hooks run in parallel, through the shell, the way the session is going
+ * to be run; one starts once those it comes after have succeeded. A hook
+ * gets timeout seconds (5 by default) and all of them together deadline
+ * seconds, after which whatever is left is killed and the session starts.
+ */
+#define HOOK_TIMEOUT  5
+#define HOOK_DEADLINE 10
+
+void run_hooks(struct launch_t *l, char **hooks, int deadline);
+
+#endif /* TUI_HOOKS_H */
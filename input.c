@@ -0,0 +1,230 @@
+/* -*- mode: c; -*- */
+
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "ui.h"
+
+/* how long Esc waits for the rest of a sequence, in milliseconds */
+#define ESC_DELAY 50
+
+/* a paste the terminal has not closed ends when it stops coming for this */
+#define PASTE_IDLE 1000
+
+/* the brackets of a paste, never handed out */
+enum { PASTE_BEGIN = -2, PASTE_END = -3 };
+
+/* the linux console sends F1 and F2 as ESC [ [ A and B */
+static const struct input_seq_t builtin[] = {
+        { "\033[D", UI_KEY_LEFT },  { "\033OD", UI_KEY_LEFT },
+        { "\033[C", UI_KEY_RIGHT }, { "\033OC", UI_KEY_RIGHT },
+        { "\033[3~", UI_KEY_DELETE },
+        { "\033[[A", UI_KEY_F1 },   { "\033OP", UI_KEY_F1 },
+        { "\033[11~", UI_KEY_F1 },
+        { "\033[[B", UI_KEY_F2 },   { "\033OQ", UI_KEY_F2 },
+        { "\033[12~", UI_KEY_F2 },
+        { "\033[200~", PASTE_BEGIN },
+        { "\033[201~", PASTE_END },
+};
+
+static long long
+now_ms()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static size_t
+pending(struct input_t *in)
+{
+        return in->tail - in->head;
+}
+
+/* reads whatever has come in, waiting up to ms for it */
+static void
+fill(struct input_t *in, int ms)
+{
+        struct pollfd pfd = { in->fd, POLLIN, 0 };
+        size_t left;
+        ssize_t n;
+
+        if (in->head) {
+                left = pending(in);
+
+                /* what has been consumed may have been a password */
+                memmove(in->keys, in->keys + in->head, left);
+                explicit_bzero(in->keys + left, in->tail - left);
+
+                in->tail = left;
+                in->head = 0;
+        }
+
+        if (sizeof in->keys == in->tail || 0 >= poll(&pfd, 1, ms))
+                return;
+
+        n = read(in->fd, in->keys + in->tail, sizeof in->keys - in->tail);
+        if (0 >= n)
+                return;
+
+        in->tail += n;
+
+        if (in->paste) {
+                if (now_ms() - in->pasted > PASTE_IDLE)
+                        in->paste = 0;
+                else
+                        in->pasted = now_ms();
+        }
+}
+
+/*
+ * The length of the escape sequence at the head of the keys, 0 if it is
+ * not complete yet.
+ */
+static size_t
+sequence_length(struct input_t *in)
+{
+        const unsigned char *s = in->keys + in->head;
+        size_t i, n = pending(in);
+
+        if (2 > n)
+                return 0;
+
+        if ('O' == s[1])
+                return 3 <= n ? 3 : 0;
+
+        if ('[' == s[1] && 3 <= n && '[' == s[2])
+                return 4 <= n ? 4 : 0;
+
+        for (i = 2; i < n; ++i) {
+                if (0x40 <= s[i] && s[i] <= 0x7e)
+                        return i + 1;
+        }
+
+        return 0;
+}
+
+static int
+lookup(const struct input_seq_t *seqs, size_t nseqs,
+       const unsigned char *s, size_t n)
+{
+        size_t i;
+
+        for (i = 0; i < nseqs; ++i) {
+                if (n == strlen(seqs[i].seq) && 0 == memcmp(s, seqs[i].seq, n))
+                        return seqs[i].key;
+        }
+
+        return UI_KEY_NONE;
+}
+
+static int
+sequence_key(struct input_t *in, size_t n)
+{
+        const unsigned char *s = in->keys + in->head;
+        int c;
+
+        if (UI_KEY_NONE != (c = lookup(in->seqs, in->nseqs, s, n)))
+                return c;
+
+        return lookup(builtin, sizeof builtin / sizeof *builtin, s, n);
+}
+
+/**********************************************************************/
+
+void input_init(struct input_t *in, int fd)
+{
+        memset(in, 0, sizeof *in);
+        in->fd = fd;
+}
+
+/* drops whatever has not been read yet, and wipes the buffer */
+void input_wipe(struct input_t *in)
+{
+        explicit_bzero(in->keys, sizeof in->keys);
+
+        in->head = in->tail = 0;
+        in->paste = 0;
+}
+
+/* the next key, UI_KEY_NONE once the terminal has nothing more for now */
+int input_key(struct input_t *in)
+{
+        const unsigned char *s;
+        size_t n;
+        int c;
+
+        for (;;) {
+                if (0 == pending(in))
+                        fill(in, 0);
+
+                if (0 == pending(in))
+                        return UI_KEY_NONE;
+
+                c = in->keys[in->head];
+
+                if (27 != c) {
+                        ++in->head;
+
+                        if (in->paste) {
+                                if (0x20 <= c && 127 != c)
+                                        return c;
+
+                                continue;
+                        }
+
+                        switch (c) {
+                        case 8: case 127:   return UI_KEY_BACKSPACE;
+                        case '\r': case '\n': return UI_KEY_ENTER;
+                        default:            return c;
+                        }
+                }
+
+                /* Esc is told apart from a sequence by what follows */
+                if (1 == pending(in))
+                        fill(in, ESC_DELAY);
+
+                s = in->keys + in->head;
+
+                if (1 == pending(in) || ('[' != s[1] && 'O' != s[1])) {
+                        ++in->head;
+
+                        if (in->paste)
+                                continue;
+
+                        return 27;
+                }
+
+                if (0 == (n = sequence_length(in))) {
+                        fill(in, ESC_DELAY);
+
+                        if (0 == (n = sequence_length(in))) {
+                                ++in->head;
+
+                                if (in->paste)
+                                        continue;
+
+                                return 27;
+                        }
+                }
+
+                c = sequence_key(in, n);
+                in->head += n;
+
+                if (PASTE_BEGIN == c) {
+                        in->paste = 1;
+                        in->pasted = now_ms();
+                }
+                else if (PASTE_END == c)
+                        in->paste = 0;
+                else if (UI_KEY_NONE != c && !in->paste)
+                        return c;
+
+                /* keys the form has no use for, and sequences in a paste */
+        }
+}
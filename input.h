@@ -0,0 +1,41 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_INPUT_H
+#define TUI_INPUT_H
+
+#include <stddef.h>
+
+/*
+ * Keys read straight from a terminal, for both backends: whatever the
+ * terminal has sent is drained in one read(), escape sequences are matched
+ * as they come out of the buffer, and a bracketed paste comes out as plain
+ * characters, without the line ends and tabs that would move about the
+ * form. seqs, if any, are the terminal's own sequences, tried before the
+ * built-in ones.
+ */
+#define INPUT_SIZE 512
+
+struct input_seq_t {
+        const char *seq;
+        int key;
+};
+
+struct input_t {
+        int fd;
+
+        const struct input_seq_t *seqs;
+        size_t nseqs;
+
+        unsigned char keys[INPUT_SIZE];
+        size_t head, tail;
+
+        /* in a paste, and when it last brought anything */
+        int paste;
+        long long pasted;
+};
+
+void input_init(struct input_t *in, int fd);
+int input_key(struct input_t *in);
+void input_wipe(struct input_t *in);
+
+#endif /* TUI_INPUT_H */
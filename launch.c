@@ -0,0 +1,411 @@
+/* -*- mode: c; -*- */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "launch.h"
+#include "trace.h"
+#include "utils.h"
+
+extern char **environ;
+
+static const char *session_path = "/usr/local/sbin:/usr/bin:/bin";
+
+static int
+env_put(struct launch_t *l, char *kv)
+{
+        size_t i, n;
+        char **pp;
+
+        if (0 == kv)
+                return 1;
+
+        n = strchr(kv, '=') - kv + 1;
+
+        for (i = 0; i < l->nenv; ++i) {
+                if (0 == strncmp(l->envp[i], kv, n)) {
+                        free(l->envp[i]);
+                        l->envp[i] = kv;
+                        return 0;
+                }
+        }
+
+        if (l->nenv + 1 >= l->envlen) {
+                l->envlen = l->envlen ? 2 * l->envlen : 32;
+
+                pp = realloc(l->envp, l->envlen * sizeof *pp);
+                if (0 == pp) {
+                        free(kv);
+                        return 1;
+                }
+
+                l->envp = pp;
+        }
+
+        l->envp[l->nenv++] = kv;
+        l->envp[l->nenv] = 0;
+
+        return 0;
+}
+
+static int
+env_set(struct launch_t *l, const char *var, const char *value)
+{
+        if (env_put(l, snprintf_(0, 0, "%s=%s", var, value))) {
+                fprintf(stderr, "failed to set %s=%s\n", var, value);
+                return 1;
+        }
+
+        return 0;
+}
+
+/*
+ * The session gets our environment, the login variables and then whatever
+ * the PAM modules have set, in that order of precedence.
+ */
+static int
+setup_env(struct launch_t *l, const struct passwd *pwd, char **pam_envs)
+{
+        const char *s;
+        char **env;
+
+        for (env = environ; *env; ++env) {
+                if (strchr(*env, '=') && env_put(l, strdup(*env)))
+                        return 1;
+        }
+
+        s = getenv("TERM");
+        if (0 == s || 0 == s[0])
+                s = "linux";
+
+        if (env_set(l, "TERM", s))
+                return 1;
+
+        s = getenv("LANG");
+        if (0 == s || 0 == s[0])
+                s = "C";
+
+        if (env_set(l, "LANG",    s)             ||
+            env_set(l, "HOME",    pwd->pw_dir)   ||
+            env_set(l, "PWD",     pwd->pw_dir)   ||
+            env_set(l, "SHELL",   pwd->pw_shell) ||
+            env_set(l, "USER",    pwd->pw_name)  ||
+            env_set(l, "LOGNAME", pwd->pw_name)  ||
+            env_set(l, "PATH",    session_path)) {
+                return 1;
+        }
+
+        for (env = pam_envs; env && *env; ++env) {
+                if (strchr(*env, '=') && env_put(l, strdup(*env))) {
+                        fprintf(stderr, "failed to set %s\n", *env);
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+static int
+setup_groups(struct launch_t *l, const struct passwd *pwd,
+             const gid_t *groups, int ngroups)
+{
+        int n = 32;
+        gid_t *p;
+
+        if (groups) {
+                if (0 == (l->groups = malloc(ngroups * sizeof *groups)))
+                        return 1;
+
+                memcpy(l->groups, groups, ngroups * sizeof *groups);
+                l->ngroups = ngroups;
+
+                return 0;
+        }
+
+        for (;;) {
+                p = realloc(l->groups, n * sizeof *p);
+                if (0 == p)
+                        return 1;
+
+                l->groups = p;
+
+                if (-1 != getgrouplist(pwd->pw_name, pwd->pw_gid, p, &n))
+                        break;
+        }
+
+        l->ngroups = n;
+
+        return 0;
+}
+
+/*
+ * Resolves the program the way execvp would, against the PATH the session
+ * is going to get, so that the child does not search.
+ */
+char *launch_resolve(const char *name)
+{
+        const char *p, *q;
+        char *s;
+
+        if (strchr(name, '/'))
+                return strdup(name);
+
+        for (p = session_path; *p; p = *q ? q + 1 : q) {
+                q = strchrnul(p, ':');
+
+                s = snprintf_(0, 0, "%.*s/%s", (int)(q - p), p, name);
+                if (0 == s || 0 == access(s, X_OK))
+                        return s;
+
+                free(s);
+        }
+
+        return 0;
+}
+
+int launch_prepare(struct launch_t *l, const struct passwd *passwd,
+                   const gid_t *groups, int ngroups, char **pam_envs)
+{
+        memset(l, 0, sizeof *l);
+
+        l->cgroup = -1;
+
+        l->report = mmap(0, sizeof *l->report, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == l->report) {
+                fprintf(stderr, "mmap : %s\n", strerror(errno));
+                return 1;
+        }
+
+        l->uid = passwd->pw_uid;
+        l->gid = passwd->pw_gid;
+
+        /* an unprivileged logitty can only start sessions of its own user */
+        l->setcreds = 0 == geteuid() || geteuid() != l->uid;
+
+        if (0 == (l->dir = strdup(passwd->pw_dir)))
+                return 1;
+
+        TRACE_START(TRACE_GETGROUPLIST);
+        if (setup_groups(l, passwd, groups, ngroups)) {
+                fprintf(stderr, "getgrouplist : %s\n", strerror(errno));
+                return 1;
+        }
+        TRACE_STOP(TRACE_GETGROUPLIST);
+
+        TRACE_START(TRACE_SETUP_ENV);
+        if (setup_env(l, passwd, pam_envs))
+                return 1;
+        TRACE_STOP(TRACE_SETUP_ENV);
+
+        return 0;
+}
+
+/*
+ * The program to run, found on the session's PATH; set apart from the rest
+ * so that another can be tried if it is not there.
+ */
+int launch_target(struct launch_t *l, char **argv)
+{
+        char *path;
+
+        if (0 == (path = launch_resolve(argv[0]))) {
+                fprintf(stderr, "%s : command not found\n", argv[0]);
+                return 1;
+        }
+
+        free(l->path);
+
+        l->path = path;
+        l->argv = argv;
+
+        return 0;
+}
+
+/* set once the kernel has refused clone3 into a cgroup */
+static int no_clone_into;
+
+static int
+cloning(struct launch_t *l)
+{
+        return 0 <= l->cgroup && !no_clone_into;
+}
+
+/*
+ * Forks a child straight into the cgroup whose directory is dir, which
+ * spares the session the cost of being moved there. Like vfork we are
+ * suspended until the child has exec'd, but the child has a copy of our
+ * memory and reports a failure through l->report.
+ */
+static pid_t
+clone_into(int dir)
+{
+        struct clone_args args;
+
+        memset(&args, 0, sizeof args);
+
+        args.flags = CLONE_VFORK | CLONE_INTO_CGROUP;
+        args.exit_signal = SIGCHLD;
+        args.cgroup = dir;
+
+        return syscall(SYS_clone3, &args, sizeof args);
+}
+
+/* join, if not -1, is the cgroup the child has to move itself into */
+static void
+child(struct launch_t *l, sigset_t *mask, int join)
+{
+        struct launch_report_t *r = l->report;
+        int fd;
+
+        TRACE_STOP(TRACE_FORK);
+
+        if (0 <= join) {
+                fd = openat(join, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+                if (0 > fd || 1 != write(fd, "0", 1)) {
+                        r->stage = "cgroup.procs";
+                        goto err;
+                }
+
+                close(fd);
+        }
+
+        TRACE_START(TRACE_SETUID);
+        if (l->setcreds && setgroups(l->ngroups, l->groups)) {
+                r->stage = "setgroups";
+                goto err;
+        }
+
+        if (l->setcreds && (setgid(l->gid) || setuid(l->uid))) {
+                r->stage = "setuid";
+                goto err;
+        }
+
+        if (chdir(l->dir)) {
+                r->stage = "chdir";
+                goto err;
+        }
+        TRACE_STOP(TRACE_SETUID);
+
+        sigprocmask(SIG_SETMASK, mask, 0);
+
+        /* in daemon mode stderr is still the log */
+        if (!isatty(STDERR_FILENO))
+                dup2(STDIN_FILENO, STDERR_FILENO);
+
+        TRACE_START(TRACE_EXEC);
+        execve(l->path, l->argv, l->envp);
+        r->stage = "execve";
+
+err:
+        r->err = errno;
+        _exit(127);
+}
+
+/*
+ * The child shares our memory until it has exec'd, or has a copy of it if
+ * it is cloned into a cgroup: it must not allocate or touch stdio, and it
+ * leaves the reason of a failure in l->report, which is shared either way.
+ * Where clone3 cannot do it, the vforked child moves itself into the
+ * cgroup through cgroup.procs.
+ */
+pid_t launch_spawn(struct launch_t *l)
+{
+        sigset_t mask;
+        pid_t pid = -1;
+
+        sigemptyset(&mask);
+
+        l->report->stage = 0;
+        l->report->err = 0;
+
+        TRACE_START(TRACE_FORK);
+
+        if (cloning(l)) {
+                if (0 == (pid = clone_into(l->cgroup)))
+                        child(l, &mask, -1);
+
+                /* before Linux 5.7, or a cgroup setup it does not take */
+                if (0 > pid &&
+                    (ENOSYS == errno || EINVAL == errno || E2BIG == errno)) {
+                        fprintf(stderr, "clone3 : %s, using vfork\n",
+                                strerror(errno));
+                        no_clone_into = 1;
+                }
+        }
+
+        if (!cloning(l) && 0 == (pid = vfork()))
+                child(l, &mask, l->cgroup);
+
+        if (0 > pid) {
+                fprintf(stderr, "%s : %s\n",
+                        cloning(l) ? "clone3" : "vfork", strerror(errno));
+                return -1;
+        }
+
+        if (l->report->stage) {
+                fprintf(stderr, "%s : %s\n",
+                        l->report->stage, strerror(l->report->err));
+                waitpid(pid, 0, 0);
+                return -1;
+        }
+
+        /* a cloned child has traced into its own copy, fork covers it all */
+        if (cloning(l))
+                TRACE_STOP(TRACE_FORK);
+        else
+                TRACE_STOP(TRACE_EXEC);
+
+        return pid;
+}
+
+/*
+ * Runs a command line through the shell the way the session is going to
+ * be run: as the user, with its environment, in its cgroup.
+ */
+pid_t launch_command(struct launch_t *l, const char *command)
+{
+        char *argv[] = { "sh", "-c", (char *)command, 0 };
+        char *path = l->path, **saved = l->argv;
+        pid_t pid;
+
+        l->path = "/bin/sh";
+        l->argv = argv;
+
+        pid = launch_spawn(l);
+
+        l->path = path;
+        l->argv = saved;
+
+        return pid;
+}
+
+void launch_free(struct launch_t *l)
+{
+        size_t i;
+
+        for (i = 0; i < l->nenv; ++i)
+                free(l->envp[i]);
+
+        free(l->envp);
+        free(l->groups);
+        free(l->path);
+        free(l->dir);
+
+        if (l->report && MAP_FAILED != l->report)
+                munmap(l->report, sizeof *l->report);
+
+        memset(l, 0, sizeof *l);
+}
@@ -0,0 +1,50 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_LAUNCH_H
+#define TUI_LAUNCH_H
+
+#include <pwd.h>
+#include <sys/types.h>
+
+/* filled in by the child if it fails before execve */
+struct launch_report_t {
+        const char *stage;
+        int err;
+};
+
+/*
+ * Everything the session child needs, worked out in the parent: the child
+ * itself only switches credentials, changes directory and calls execve.
+ */
+struct launch_t {
+        char *path, **argv;
+
+        char **envp;
+        size_t nenv, envlen;
+
+        uid_t uid;
+        gid_t gid, *groups;
+        int ngroups, setcreds;
+
+        char *dir;
+
+        /* the directory of the session's cgroup, or -1 */
+        int cgroup;
+
+        struct launch_report_t *report;
+};
+
+/*
+ * groups, if not null, are the user's groups looked up already. The program
+ * is set with launch_target before the session is spawned.
+ */
+int launch_prepare(struct launch_t *l, const struct passwd *passwd,
+                   const gid_t *groups, int ngroups, char **pam_envs);
+int launch_target(struct launch_t *l, char **argv);
+pid_t launch_spawn(struct launch_t *l);
+pid_t launch_command(struct launch_t *l, const char *command);
+void launch_free(struct launch_t *l);
+
+char *launch_resolve(const char *name);
+
+#endif /* TUI_LAUNCH_H */
@@ -3,7 +3,9 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <limits.h>
+#include <time.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,204 +13,1272 @@
 #include <unistd.h>
 
 #include <linux/vt.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/signalfd.h>
 #include <sys/utsname.h>
-
-#include <ncurses.h>
-#include <form.h>
+#include <sys/wait.h>
+#include <termios.h>
 
 #include <utils.h>
 
+#include "acct.h"
+#include "cache.h"
+#include "cgroup.h"
+#include "events.h"
+#include "hooks.h"
+#include "metrics.h"
+#include "prefetch.h"
 #include "run.h"
+#include "secret.h"
+#include "startup.h"
+#include "throttle.h"
+#include "trace.h"
 #include "ui.h"
+#include "users.h"
+#include "vt.h"
 
 #define UNUSED(x) ((void)(x))
 
-static struct {
-        char *label;
-        char *argv[16];
-} startups[] = {
-        { "shell", { "/bin/bash", 0 } },
-        { "dwl",   { "/usr/local/bin/run-dwl.sh", 0 }  }
-};
+static const char *startups_conf  = "/etc/logitty/sessions.conf";
+static const char *startups_cache = "/var/cache/logitty/sessions.cache";
+
+static struct startups_t *startups;
+
+static const char *acct_dir;
+static const char *cgroup_root;
+static const char *metrics_socket;
+static const char *events_file;
+
+/* records in a new event log, about 2.5MB */
+#define EVENTS_CAPACITY 16384
+
+static int force_serial;
+static int switch_users;
+
+/* seconds a verifier is kept, 0 leaves the credential cache off */
+static int cache_ttl;
+
+/* seconds a user looked up ahead is kept, 0 for no lookup ahead */
+static int users_ttl = USERS_TTL;
+
+/* --profile-startup: milliseconds from main() to each step, on stderr */
+static int profile_startup;
+static struct timespec startup_t0;
+
+static void
+profile(const char *name, const char *step)
+{
+        struct timespec ts;
+
+        if (!profile_startup)
+                return;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        fprintf(stderr, "startup: %s %s %.3f\n", name, step,
+                (ts.tv_sec - startup_t0.tv_sec) * 1e3 +
+                (ts.tv_nsec - startup_t0.tv_nsec) / 1e6);
+}
 
 static char *
-field_buffer_trim(FIELD *f)
+field_buffer_trim(struct screen_t *screen, int field)
 {
         char buf[256], *pbuf;
 
-        pbuf = wstrim(field_buffer(f, 0), buf, sizeof buf);
+        pbuf = wstrim(field_text(screen, field), buf, sizeof buf);
         if (pbuf == buf)
                 pbuf = strdup(buf);
 
         return pbuf;
 }
 
+/*
+ * The password goes from the form's buffer straight to the arena, and the
+ * field is cleared: the form holds no copy once it has been submitted.
+ */
+static char *
+field_buffer_secret(struct screen_t *screen, int field)
+{
+        const char *pbeg, *pend;
+        char *secret = 0;
+        size_t n;
+
+        for (pbeg = field_text(screen, field); ' ' == *pbeg; ++pbeg) ;
+        for (pend = pbeg + strlen(pbeg); pend != pbeg && ' ' == pend[-1];
+             --pend) ;
+
+        n = pend - pbeg;
+        if (n < SECRET_SIZE && (secret = secret_alloc())) {
+                memcpy(secret, pbeg, n);
+                secret[n] = 0;
+        }
+
+        clear_field(screen, field);
+
+        return secret;
+}
+
+/* the cgroup settings of entry i, as key, value pairs */
 static char **
-startup_argvs(const char *startup)
+startup_limits(int i)
 {
-        size_t i;
+        const char **pp, *v;
+        char **limits;
+        size_t n = 0;
+
+        for (pp = cgroup_keys; *pp; ++pp) ;
+
+        limits = malloc((2 * (pp - cgroup_keys) + 1) * sizeof *limits);
+        if (0 == limits)
+                return 0;
 
-        for (i = 0; i < sizeof startups / sizeof *startups; ++i) {
-                if (0 == strcmp(startup, startups[i].label)) {
-                        return startups[i].argv;
+        for (pp = cgroup_keys; *pp; ++pp) {
+                if ((v = startup_value(startups, i, *pp))) {
+                        limits[n++] = (char *)*pp;
+                        limits[n++] = (char *)v;
                 }
         }
 
-        return 0;
+        limits[n] = 0;
+
+        return limits;
 }
 
 static char **
-startup_labels(char **ppbuf, size_t len)
+startup_labels()
 {
-        size_t i;
+        char **labels;
+        size_t i, n;
+
+        n = startups_count(startups);
+
+        labels = malloc((n + 1) * sizeof *labels);
+        if (0 == labels)
+                return 0;
+
+        for (i = 0; i < n; ++i)
+                labels[i] = (char *)startup_label(startups, i);
+        labels[i] = 0;
+
+        return labels;
+}
+
+static int
+read_login(struct screen_t *screen, struct login_t *login)
+{
+        const char *deadline, *restarts, *fallback;
+        char *startup;
+        int i, j;
+
+        TRACE_BEGIN();
+
+        memset(login, 0, sizeof *login);
+
+        startup = field_buffer_trim(screen, UI_STARTUP);
+        if (0 > (i = startup_find(startups, startup))) {
+                fprintf(stderr, "invalid startup label %s\n", startup);
+                free(startup);
+                return 1;
+        }
+
+        free(startup);
+
+        login->argv = startup_argv(startups, i);
+        login->limits = startup_limits(i);
+        login->hooks = startup_values(startups, i, "hook");
+
+        deadline = startup_value(startups, i, "hook-deadline");
+        login->deadline = deadline ? atoi(deadline) : HOOK_DEADLINE;
 
-        if (len - 1 < sizeof startups / sizeof *startups) {
-                len = sizeof startups / sizeof *startups + 1;
+        restarts = startup_value(startups, i, "restart");
+        login->restarts = restarts ? atoi(restarts) : 0;
 
-                ppbuf = malloc(len * sizeof(char *));
-                if (0 == ppbuf)
-                        return 0;
+        if ((fallback = startup_value(startups, i, "fallback"))) {
+                if (0 > (j = startup_find(startups, fallback)) || j == i)
+                        fprintf(stderr, "invalid fallback %s\n", fallback);
+                else
+                        login->fallback = startup_argv(startups, j);
         }
 
-        for (i = 0; i < sizeof startups / sizeof *startups; ++i)
-                ppbuf[i] = startups[i].label;
-        ppbuf[i] = 0;
+        login->username = field_buffer_trim(screen, UI_LOGIN);
+        login->password = field_buffer_secret(screen, UI_PASSWORD);
 
-        return ppbuf;
+        return 0 == login->argv || 0 == login->limits ||
+                0 == login->hooks || 0 == login->password;
 }
 
 static void
-loop(struct screen_t *screen)
+free_login(struct login_t *login)
 {
-        int c, cont = 1;
-        char *startup, *username, *password, **argv;
+        free(login->argv);
+        free(login->limits);
+        free(login->hooks);
+        free(login->fallback);
+        free(login->username);
 
-        FORM *f = 0;
-        FIELD **fs = 0;
+        explicit_bzero(login->verifier, sizeof login->verifier);
 
-        f  = screen->form;
-        fs = screen->fields;
+        secret_free(login->password);
+}
 
-        form_driver(f, REQ_NEXT_CHOICE);
+static void
+paint_screen(struct screen_t *screen)
+{
         draw_screen(screen);
+        update_screen(screen);
+}
 
-        while(cont && ERR != (c = getch())) {
-                switch (c) {
-                case KEY_F(1):
-                        endwin();
-                        execvp("reboot", (char *[]){ "reboot", 0 });
+/**********************************************************************/
+
+/*
+ * Every terminal we serve, be it the one agetty has given us or one of the
+ * VTs of daemon mode, has its own terminal and form. A login is run
+ * by a worker child so that the form stays responsive while PAM is busy: the
+ * worker reports over a pipe either that the session is starting, at which
+ * point we stop reading the terminal until it is reaped, or why the login
+ * has failed. A login the throttle holds back waits in TTY_WAIT, with the
+ * form still served, until it is due.
+ */
+enum { TTY_IDLE, TTY_WAIT, TTY_AUTH, TTY_SESSION };
+
+struct tty_t {
+        const char *name;
+
+        FILE *fp;
+        struct term_t *term;
+        struct screen_t *screen;
+        struct pam_handle *pamh;
+        struct acct_t acct;
+
+        int fd, claim, state, spin, status;
+        int serial, linger;
+
+        pid_t pid;
+        int notify;
+        char username[32];
+
+        struct login_t held;
+        long long due;
+
+        /* when the session started, for its duration */
+        long long since;
+
+        /* 1 + the entry last prefetched for, 0 for none */
+        int prefetched;
+
+        /* with -f: this VT's number, and where the login in progress goes */
+        int vt, target;
+        struct session_t *session;
+};
+
+/*
+ * With -f, sessions run on VTs of their own, allocated at login, and the
+ * form is back as soon as one has started. A user who logs in again is
+ * taken to the session they have, once the password has been checked.
+ * Sessions are indexed by VT number.
+ */
+struct session_t {
+        char username[32];
+        struct acct_t acct;
+        struct tty_t *greeter;
+
+        int fd, vt;
+        pid_t pid;
+        long long since;
+};
+
+static struct session_t sessions[MAX_NR_CONSOLES + 1];
+
+static struct session_t *
+find_session(const char *username)
+{
+        int i;
+
+        for (i = 1; i <= MAX_NR_CONSOLES; ++i) {
+                if (sessions[i].pid &&
+                    0 == strcmp(sessions[i].username, username))
+                        return sessions + i;
+        }
+
+        return 0;
+}
+
+/* a VT for the session of username, from the form on tty */
+static struct session_t *
+open_session(struct tty_t *tty, const char *username)
+{
+        struct session_t *s;
+        int fd, vt;
+
+        if (0 > (fd = vt_alloc(tty->fd, &vt)))
+                return 0;
+
+        s = sessions + vt;
+        memset(s, 0, sizeof *s);
+
+        snprintf(s->username, sizeof s->username, "%s", username);
+        s->greeter = tty;
+        s->fd = fd;
+        s->vt = vt;
+
+        acct_prepare(&s->acct, fd);
+
+        return s;
+}
+
+static void
+close_session(struct session_t *s)
+{
+        struct tty_t *tty = s->greeter;
+
+        acct_logout(&s->acct);
+        cgroup_reap(s->fd);
+
+        if (s->pid)
+                metrics_session_close(s->vt, s->since);
+
+        /* back to the form if the session was in front */
+        if (s->pid && s->vt == vt_active(tty->fd))
+                vt_activate(tty->fd, tty->vt, 0);
+
+        close(s->fd);
+        vt_release(tty->fd, s->vt);
+
+        memset(s, 0, sizeof *s);
+}
+
+static void
+show_status(struct tty_t *tty, const char *msg)
+{
+        select_term(tty->term);
+        draw_message(tty->screen, msg);
+        update_screen(tty->screen);
+}
+
+static void
+spin(struct tty_t *tty)
+{
+        static const char spinner[] = "|/-\\";
+        char buf[64];
+
+        /* a serial line has better uses for its bandwidth */
+        if (tty->serial) {
+                if (0 == tty->spin++)
+                        show_status(tty, "authenticating  (Esc cancels)");
+
+                return;
+        }
+
+        snprintf(buf, sizeof buf, "authenticating %c  (Esc cancels)",
+                 spinner[tty->spin++ % (sizeof spinner - 1)]);
+
+        show_status(tty, buf);
+}
+
+static long long
+now_ms()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void
+show_wait(struct tty_t *tty)
+{
+        char buf[64];
+
+        snprintf(buf, sizeof buf, "please wait %llds  (Esc cancels)",
+                 (tty->due - now_ms() + 999) / 1000);
+
+        show_status(tty, buf);
+}
+
+static void
+fork_login(struct tty_t *tty, struct login_t *login)
+{
+        const char *verifier;
+        sigset_t mask;
+        int fds[2];
+
+        /* the worker gets a copy, the cache is wiped in children */
+        if (cache_enabled()) {
+                login->cache = 1;
+
+                if ((verifier = cache_find(login->username)))
+                        strcpy(login->verifier, verifier);
+        }
+
+        if (switch_users) {
+                if ((tty->session = find_session(login->username))) {
+                        tty->target = tty->session->vt;
+                        tty->session = 0;
+                        login->verify = 1;
+                }
+                else if ((tty->session = open_session(tty, login->username))) {
+                        tty->target = 0;
+                        login->vt = tty->session->vt;
+                }
+                else {
+                        show_status(tty, "no free virtual terminal");
+                        return;
+                }
+        }
+
+        if (pipe2(fds, O_CLOEXEC)) {
+                fprintf(stderr, "pipe : %s\n", strerror(errno));
+
+                /* the VT allocated for the session goes back */
+                if (tty->session)
+                        close_session(tty->session);
+                tty->session = 0;
+                return;
+        }
+
+        tty->pid = fork();
+        if (0 == tty->pid) {
+                close(fds[0]);
+
+                sigemptyset(&mask);
+                sigaddset(&mask, SIGCHLD);
+                sigprocmask(SIG_UNBLOCK, &mask, 0);
+
+                secret_lock();
+
+                if (tty->session) {
+                        if (vt_claim(tty->session->fd))
+                                _exit(1);
+
+                        _exit(run(tty->pamh, &tty->session->acct,
+                                  login, fds[1]));
+                }
+
+                if (tty->claim && !login->verify && vt_claim(tty->fd))
+                        _exit(1);
+
+                _exit(run(tty->pamh, &tty->acct, login, fds[1]));
+        }
+
+        close(fds[1]);
+
+        if (0 > tty->pid) {
+                fprintf(stderr, "fork : %s\n", strerror(errno));
+                close(fds[0]);
+                tty->pid = 0;
+
+                if (tty->session)
+                        close_session(tty->session);
+                tty->session = 0;
+        }
+        else {
+                /* the worker has taken over the pre-started handle */
+                discard_pam(tty->pamh);
+                tty->pamh = 0;
+
+                fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+                tty->notify = fds[0];
+                tty->state = TTY_AUTH;
+                tty->status = -1;
+                tty->spin = 0;
+
+                busy_screen(tty->screen, 1);
+                spin(tty);
+        }
+}
+
+static void
+start_login(struct tty_t *tty)
+{
+        struct login_t login;
+        long delay;
+        char buf[64];
+
+        if (read_login(tty->screen, &login)) {
+                show_status(tty, "login failed");
+                free_login(&login);
+                return;
+        }
+
+        snprintf(tty->username, sizeof tty->username, "%s", login.username);
+        metrics_add(METRIC_LOGIN_ATTEMPTS, 1);
+
+        if (throttle_check(login.username, tty->name, &delay)) {
+                snprintf(buf, sizeof buf, "too many attempts, wait %lds",
+                         (delay + 999) / 1000);
+                show_status(tty, buf);
+                free_login(&login);
+                return;
+        }
+
+        /* held back, with the form still served */
+        if (delay) {
+                tty->held = login;
+                tty->due = now_ms() + delay;
+                tty->state = TTY_WAIT;
+
+                busy_screen(tty->screen, 1);
+                show_wait(tty);
+                return;
+        }
+
+        fork_login(tty, &login);
+        free_login(&login);
+}
+
+/* a held login, once it is due */
+static void
+release_login(struct tty_t *tty)
+{
+        if (tty->due > now_ms()) {
+                show_wait(tty);
+                return;
+        }
+
+        tty->state = TTY_IDLE;
+
+        draw_message(tty->screen, "");
+        fork_login(tty, &tty->held);
+        free_login(&tty->held);
+
+        if (TTY_IDLE == tty->state) {
+                busy_screen(tty->screen, 0);
+                update_screen(tty->screen);
+        }
+}
+
+static void
+cancel_login(struct tty_t *tty)
+{
+        if (TTY_AUTH == tty->state && tty->pid)
+                kill(tty->pid, SIGTERM);
+
+        if (TTY_WAIT == tty->state) {
+                free_login(&tty->held);
+                tty->state = TTY_IDLE;
+                metrics_add(METRIC_LOGIN_CANCELLED, 1);
+
+                busy_screen(tty->screen, 0);
+                show_status(tty, "login cancelled");
+        }
+}
+
+static void
+clear_form(struct tty_t *tty)
+{
+        select_term(tty->term);
+
+        clear_field(tty->screen, UI_LOGIN);
+        clear_field(tty->screen, UI_PASSWORD);
+        focus_field(tty->screen, UI_LOGIN);
+
+        busy_screen(tty->screen, 0);
+        draw_message(tty->screen, "");
+        update_screen(tty->screen);
+}
+
+/*
+ * With -f, the user is authenticated: the session, new or old, is brought to
+ * the front and the form is cleared for the next one. A new session's
+ * worker is tracked with the session from now on.
+ */
+static void
+hand_over(struct tty_t *tty)
+{
+        if (tty->session) {
+                tty->session->pid = tty->pid;
+                tty->session->since = metrics_clock();
+                metrics_session_open(tty->session->vt);
+                tty->session = 0;
+        }
+        else
+                vt_activate(tty->fd, tty->target, 0);
+
+        close(tty->notify);
+        tty->notify = -1;
+
+        tty->state = TTY_IDLE;
+        tty->pid = 0;
+
+        clear_form(tty);
+
+        tty->pamh = prepare_pam();
+}
+
+/*
+ * Reads what the worker has to say: 0 once it has authenticated the user and
+ * is starting the session, an error status otherwise.
+ */
+static void
+read_notify(struct tty_t *tty)
+{
+        struct notice_t notice;
+        ssize_t n;
+        int status;
+
+        while (0 <= tty->notify) {
+                n = read(tty->notify, &notice, sizeof notice);
+
+                if (0 > n && (EAGAIN == errno || EINTR == errno))
                         break;
 
-                case KEY_F(2):
-                        endwin();
-                        execvp("halt", (char *[]){ "halt", "-p", 0 });
+                if (sizeof notice != n) {
+                        close(tty->notify);
+                        tty->notify = -1;
                         break;
+                }
 
-                case '\n': case KEY_ENTER: {
-                        form_driver(f, REQ_VALIDATION);
+                tty->status = status = notice.status;
 
-                        form_driver(f, REQ_NEXT_FIELD);
-                        form_driver(f, REQ_PREV_FIELD);
+                /* a failed login drops the user's verifier, to be safe */
+                if (0 == status && *notice.verifier)
+                        cache_store(tty->username, notice.verifier);
+                else if (status)
+                        cache_forget(tty->username);
 
-                        startup  = field_buffer_trim(fs[1]);
-                        if (0 == (argv = startup_argvs(startup))) {
-                                fprintf(stderr, "invalid startup label %s\n", startup);
-                                free(startup);
+                explicit_bzero(&notice, sizeof notice);
+
+                if (0 == status) {
+                        throttle_result(tty->username, tty->name, 1);
+                        metrics_add(METRIC_LOGIN_SUCCESSES, 1);
+                }
+
+                if (0 == status && TTY_AUTH == tty->state) {
+                        if (switch_users) {
+                                hand_over(tty);
                                 break;
                         }
 
-                        username = field_buffer_trim(fs[3]);
-                        password = field_buffer_trim(fs[5]);
+                        leave_term(tty->term);
+
+                        tty->state = TTY_SESSION;
+                        tty->since = metrics_clock();
+                        metrics_session_open(vt_number(tty->fd));
+                }
+        }
+}
 
-                        endwin();
-                        run(username, password, argv);
+/* how a session has ended, if worth telling: the worker exits with it */
+static void
+session_ending(int status, char *buf, size_t size)
+{
+        *buf = 0;
 
-                        free(startup);
-                        free(username);
-                        free(password);
+        if (WIFEXITED(status) && WEXITSTATUS(status))
+                run_ending(WEXITSTATUS(status), buf, size);
+}
 
-                        startup = username = password = 0;
+static void
+end_login(struct tty_t *tty, int status)
+{
+        char buf[128];
 
-                        draw_screen(screen);
-                        pos_form_cursor(f);
+        read_notify(tty);
+
+        /* handed over before it was reaped, nothing left to end */
+        if (TTY_IDLE == tty->state)
+                return;
+
+        if (0 <= tty->notify) {
+                close(tty->notify);
+                tty->notify = -1;
+        }
+
+        /* in case the worker could not do it itself */
+        acct_logout(&tty->acct);
+        cgroup_reap(tty->fd);
+
+        if (tty->session)
+                close_session(tty->session);
+        tty->session = 0;
+
+        select_term(tty->term);
+        tcflush(tty->fd, TCIFLUSH);
+        drop_keys(tty->term);
+
+        busy_screen(tty->screen, 0);
+
+        if (TTY_SESSION == tty->state) {
+                metrics_session_close(vt_number(tty->fd), tty->since);
+
+                session_ending(status, buf, sizeof buf);
+                draw_message(tty->screen, buf);
+                paint_screen(tty->screen);
+        }
+        else {
+                if (0 > tty->status) {
+                        snprintf(buf, sizeof buf, "login cancelled");
+                        metrics_add(METRIC_LOGIN_CANCELLED, 1);
+                }
+                else {
+                        snprintf(buf, sizeof buf, "login failed : %s",
+                                 run_diag(tty->status));
+                        throttle_result(tty->username, tty->name, 0);
+                        metrics_failure(tty->status);
                 }
-                        break;
 
-                case '\t':
-                        form_driver(f, REQ_NEXT_FIELD);
-                        form_driver(f, REQ_END_FIELD);
-                        break;
+                show_status(tty, buf);
+        }
 
-                case KEY_LEFT:
-                        if (fs[1] == current_field(f)) {
-                                form_driver(f, REQ_PREV_CHOICE);
-                        }
-                        else {
-                                form_driver(f, REQ_PREV_CHAR);
+        tty->state = TTY_IDLE;
+        tty->pid = 0;
+
+        tty->pamh = prepare_pam();
+}
+
+/*
+ * Waits up to ms for more input; on a slow line a paste trickles in one
+ * character at a time and would otherwise be rendered key by key.
+ */
+static int
+more_input(int fd, int ms)
+{
+        struct pollfd pfd = { fd, POLLIN, 0 };
+
+        return 0 < ms && 0 < poll(&pfd, 1, ms);
+}
+
+/*
+ * Feeds a key to the form. Returns 1 when the user has submitted the form,
+ * in which case the caller reads the fields with read_login.
+ */
+static int
+handle_key(struct tty_t *tty, int c)
+{
+        switch (c) {
+        case UI_KEY_F1:
+                leave_term(tty->term);
+                execvp("reboot", (char *[]){ "reboot", 0 });
+                break;
+
+        case UI_KEY_F2:
+                leave_term(tty->term);
+                execvp("halt", (char *[]){ "halt", "-p", 0 });
+                break;
+
+        default:
+                return feed_key(tty->screen, c);
+        }
+
+        return 0;
+}
+
+/*
+ * Once the user has moved on from the startup field, the entry shown there
+ * is likely the one to be started: its files are read ahead while the rest
+ * of the form is typed.
+ */
+static void
+prefetch_startup(struct tty_t *tty)
+{
+        const char *limit;
+        char *startup, **argv, **extra;
+        int i;
+
+        if (UI_STARTUP == focused_field(tty->screen))
+                return;
+
+        startup = field_buffer_trim(tty->screen, UI_STARTUP);
+        i = startup_find(startups, startup);
+        free(startup);
+
+        if (0 > i || i + 1 == tty->prefetched)
+                return;
+
+        tty->prefetched = i + 1;
+
+        argv = startup_argv(startups, i);
+        extra = startup_values(startups, i, "prefetch");
+        limit = startup_value(startups, i, "prefetch-limit");
+
+        if (argv && extra)
+                prefetch(argv[0], extra,
+                         limit ? prefetch_parse_limit(limit) : PREFETCH_LIMIT);
+
+        free(argv);
+        free(extra);
+}
+
+/* the user is looked up while the password is typed */
+static void
+resolve_user(struct tty_t *tty)
+{
+        char *username;
+
+        if (UI_LOGIN == focused_field(tty->screen))
+                return;
+
+        if ((username = field_buffer_trim(tty->screen, UI_LOGIN))) {
+                users_resolve(username);
+                free(username);
+        }
+}
+
+static void
+feed_tty(struct tty_t *tty)
+{
+        int c;
+
+        select_term(tty->term);
+
+        do {
+                while (UI_KEY_NONE != (c = read_key(tty->term))) {
+                        if (TTY_AUTH == tty->state ||
+                            TTY_WAIT == tty->state) {
+                                if (27 == c)
+                                        cancel_login(tty);
+                                else if (UI_KEY_F1 == c || UI_KEY_F2 == c)
+                                        handle_key(tty, c);
+
+                                continue;
                         }
-                        break;
 
-                case KEY_RIGHT:
-                        if (fs[1] == current_field(f)) {
-                                form_driver(f, REQ_NEXT_CHOICE);
+                        if (handle_key(tty, c)) {
+                                /* the password has gone through it */
+                                drop_keys(tty->term);
+
+                                draw_message(tty->screen, "");
+                                start_login(tty);
+
+                                if (TTY_IDLE != tty->state)
+                                        return;
                         }
-                        else {
-                                form_driver(f, REQ_NEXT_CHAR);
+                }
+        } while (more_input(tty->fd, tty->linger));
+
+        update_screen(tty->screen);
+
+        if (TTY_IDLE == tty->state) {
+                resolve_user(tty);
+                prefetch_startup(tty);
+        }
+}
+
+static void
+reap_logins(struct tty_t *ttys, size_t n)
+{
+        struct tty_t *greeter;
+        char buf[128];
+        pid_t pid;
+        size_t i;
+        int status;
+
+        while (0 < (pid = waitpid(-1, &status, WNOHANG))) {
+                prefetch_reaped(pid);
+                users_reaped(pid);
+
+                for (i = 0; i < n; ++i) {
+                        if (pid == ttys[i].pid)
+                                end_login(ttys + i, status);
+                }
+
+                for (i = 1; i <= MAX_NR_CONSOLES; ++i) {
+                        if (pid != sessions[i].pid)
+                                continue;
+
+                        greeter = sessions[i].greeter;
+                        close_session(sessions + i);
+
+                        /* unless the form is busy with another login */
+                        session_ending(status, buf, sizeof buf);
+                        if (*buf && TTY_IDLE == greeter->state)
+                                show_status(greeter, buf);
+                }
+        }
+}
+
+static int
+serve(struct tty_t *ttys, size_t n)
+{
+        struct pollfd *pfds;
+        struct signalfd_siginfo si;
+        sigset_t mask;
+        size_t i;
+        long long wait;
+        int sfd, timeout;
+
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+
+        if (sigprocmask(SIG_BLOCK, &mask, 0) ||
+            0 > (sfd = signalfd(-1, &mask, SFD_CLOEXEC))) {
+                fprintf(stderr, "signalfd : %s\n", strerror(errno));
+                return 1;
+        }
+
+        pfds = malloc((2 * n + 2) * sizeof *pfds);
+        if (0 == pfds) {
+                close(sfd);
+                return 1;
+        }
+
+        for (;;) {
+                timeout = -1;
+
+                for (i = 0; i < n; ++i) {
+                        pfds[i].fd = TTY_SESSION == ttys[i].state ?
+                                -1 : ttys[i].fd;
+                        pfds[i].events = POLLIN;
+
+                        pfds[n + i].fd = ttys[i].notify;
+                        pfds[n + i].events = POLLIN;
+
+                        if (TTY_AUTH == ttys[i].state && !ttys[i].serial)
+                                timeout = 100;
+
+                        /* the countdown, once a second */
+                        if (TTY_WAIT == ttys[i].state) {
+                                wait = ttys[i].due - now_ms();
+                                wait = 0 > wait ? 0 : 1000 < wait ? 1000 : wait;
+
+                                if (0 > timeout || wait < timeout)
+                                        timeout = wait;
                         }
-                        break;
+                }
 
-                case KEY_BACKSPACE:
-                case 127:
-                        /* Delete the char before cursor */
-                        form_driver(f, REQ_DEL_PREV);
-                        break;
+                pfds[2 * n].fd = sfd;
+                pfds[2 * n].events = POLLIN;
 
-                case KEY_DC:
-                        /* Delete the char under the cursor */
-                        form_driver(f, REQ_DEL_CHAR);
-                        break;
+                /* -1, and ignored, without a metrics socket */
+                pfds[2 * n + 1].fd = metrics_fd();
+                pfds[2 * n + 1].events = POLLIN;
 
-                default:
-                        form_driver(f, c);
+                if (0 > poll(pfds, 2 * n + 2, timeout)) {
+                        if (EINTR == errno)
+                                continue;
+
+                        fprintf(stderr, "poll : %s\n", strerror(errno));
                         break;
                 }
 
+                for (i = 0; i < n; ++i) {
+                        if (pfds[n + i].revents)
+                                read_notify(ttys + i);
+                }
 
-                wrefresh(screen->win);
+                if (pfds[2 * n].revents & POLLIN) {
+                        if (sizeof si == read(sfd, &si, sizeof si))
+                                reap_logins(ttys, n);
+                }
+
+                if (pfds[2 * n + 1].revents & POLLIN)
+                        metrics_serve();
+
+                for (i = 0; i < n; ++i) {
+                        if (TTY_SESSION == ttys[i].state)
+                                continue;
+
+                        if (pfds[i].revents & POLLIN)
+                                feed_tty(ttys + i);
+
+                        if (TTY_AUTH == ttys[i].state)
+                                spin(ttys + i);
+                        else if (TTY_WAIT == ttys[i].state)
+                                release_login(ttys + i);
+                }
         }
+
+        free(pfds);
+        close(sfd);
+
+        return 1;
 }
 
 static struct screen_t *
-make_screen_from_labels()
+make_screen_from_labels(int serial)
 {
         struct screen_t *screen;
-        char *labels[16], **plabels = labels;
-
-        plabels = labels;
-        plabels = startup_labels(labels, sizeof labels / sizeof *labels);
+        char **labels;
 
-        screen = make_screen(plabels);
+        if (0 == (labels = startup_labels()))
+                return 0;
 
-        if (plabels != labels)
-                free(plabels);
+        screen = make_screen(labels, serial);
+        free(labels);
 
         return screen;
 }
 
-int main()
+static int
+setup_tty(struct tty_t *tty)
 {
-        struct screen_t *screen = 0;
+        profile(tty->name, "terminal");
 
-        if (init_screen())
+        tty->screen = make_screen_from_labels(tty->serial);
+        if (0 == tty->screen)
                 return 1;
 
-        screen = make_screen_from_labels();
-        if (0 == screen)
+        paint_screen(tty->screen);
+        profile(tty->name, "paint");
+
+        return 0;
+}
+
+/*
+ * What no one sees is left for after the first paint: the accounting files,
+ * the cgroup root and the PAM handles are all ready before the first key is
+ * read, which is what matters.
+ */
+static void
+finish_setup(struct tty_t *ttys, size_t n)
+{
+        size_t i;
+
+        /* logins go on without accounting or cgroups if need be */
+        acct_open(acct_dir);
+
+        if (cgroup_root)
+                cgroup_setup(cgroup_root);
+
+        for (i = 0; i < n; ++i) {
+                acct_prepare(&ttys[i].acct, ttys[i].fd);
+                ttys[i].pamh = prepare_pam();
+        }
+
+        profile("-", "ready");
+}
+
+static int
+open_vt(struct tty_t *tty, const char *name)
+{
+        int fd;
+
+        memset(tty, 0, sizeof *tty);
+
+        tty->name = name;
+        tty->notify = -1;
+        tty->claim = 1;
+
+        if (0 > (fd = vt_open(name)))
                 return 1;
 
-        loop(screen);
-        free_screen(screen);
+        if (0 == (tty->fp = fdopen(fd, "r+"))) {
+                close(fd);
+                return 1;
+        }
 
-        return 0;
+        tty->fd = fd;
+        tty->vt = vt_number(fd);
+
+        if (0 == (tty->term = init_term(tty->fp, tty->fp)))
+                return 1;
+
+        return setup_tty(tty);
+}
+
+static int
+open_stdin(struct tty_t *tty)
+{
+        int baud;
+
+        memset(tty, 0, sizeof *tty);
+
+        tty->name = "stdin";
+        tty->notify = -1;
+        tty->fd = STDIN_FILENO;
+        tty->serial = force_serial || vt_serial(STDIN_FILENO);
+
+        if (0 == (tty->term = init_term(stdout, stdin)))
+                return 1;
+
+        /* about three characters' time on the line */
+        if (tty->serial) {
+                baud = term_baudrate(tty->term);
+                tty->linger = 0 < baud && baud < 15000 ? 30000 / baud : 2;
+        }
+
+        return setup_tty(tty);
+}
+
+static void
+close_tty(struct tty_t *tty)
+{
+        if (tty->term) {
+                select_term(tty->term);
+
+                free_screen(tty->screen);
+                free_term(tty->term);
+        }
+
+        if (TTY_WAIT == tty->state)
+                free_login(&tty->held);
+
+        discard_pam(tty->pamh);
+}
+
+static int
+run_daemon(char **names, size_t n)
+{
+        struct tty_t *ttys;
+        size_t i;
+        int ret = 1;
+
+        if (0 == n) {
+                fprintf(stderr, "no terminals given\n");
+                return 1;
+        }
+
+        ttys = calloc(n, sizeof *ttys);
+        if (0 == ttys)
+                return 1;
+
+        for (i = 0; i < n; ++i) {
+                if (open_vt(ttys + i, names[i])) {
+                        fprintf(stderr, "failed to set up %s\n", names[i]);
+                        break;
+                }
+        }
+
+        if (i == n) {
+                finish_setup(ttys, n);
+                ret = serve(ttys, n);
+        }
+
+        for (i = 0; i < n; ++i)
+                close_tty(ttys + i);
+
+        free(ttys);
+
+        return ret;
+}
+
+static int
+run_single()
+{
+        struct tty_t tty;
+        int ret = 1;
+
+        if (0 == open_stdin(&tty)) {
+                finish_setup(&tty, 1);
+                ret = serve(&tty, 1);
+        }
+
+        close_tty(&tty);
+
+        return ret;
+}
+
+static void
+usage()
+{
+        fprintf(stderr,
+                "usage: logitty [-a ttl] [-c sessions.conf] [-k cache] "
+                "[-e events] [-g cgroup] [-m socket] [-n ttl] [-p pam.d] [-s] "
+                "[-u acct-dir] [--profile-startup] [-d [-f] tty...]\n");
+}
+
+enum { OPT_PROFILE_STARTUP = 256 };
+
+static const struct option long_options[] = {
+        { "profile-startup", no_argument, 0, OPT_PROFILE_STARTUP },
+        { 0, 0, 0, 0 }
+};
+
+int main(int argc, char **argv)
+{
+        int c, ret, daemon_mode = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &startup_t0);
+
+        while (-1 != (c = getopt_long(argc, argv, "a:c:de:fg:k:m:n:p:su:",
+                                      long_options, 0))) {
+                switch (c) {
+                case OPT_PROFILE_STARTUP:
+                        profile_startup = 1;
+                        break;
+
+                case 'a':
+                        cache_ttl = atoi(optarg);
+                        break;
+
+                case 'c':
+                        startups_conf = optarg;
+                        break;
+
+                case 'e':
+                        events_file = optarg;
+                        break;
+
+                case 'f':
+                        switch_users = 1;
+                        break;
+
+                case 'g':
+                        cgroup_root = optarg;
+                        break;
+
+                case 'k':
+                        startups_cache = optarg;
+                        break;
+
+                case 'm':
+                        metrics_socket = optarg;
+                        break;
+
+                case 'n':
+                        users_ttl = atoi(optarg);
+                        break;
+
+                case 'p':
+                        run_set_pam_confdir(optarg);
+                        break;
+
+                case 's':
+                        force_serial = 1;
+                        break;
+
+                case 'u':
+                        acct_dir = optarg;
+                        break;
+
+                case 'd':
+                        daemon_mode = 1;
+                        break;
+
+                default:
+                        usage();
+                        return 1;
+                }
+        }
+
+        if (switch_users && !daemon_mode) {
+                fprintf(stderr, "-f needs -d\n");
+                return 1;
+        }
+
+        if (secret_setup())
+                return 1;
+
+        if (0 < cache_ttl && cache_setup(cache_ttl))
+                return 1;
+
+        if (0 < users_ttl && users_setup(users_ttl))
+                return 1;
+
+        /* before the first fork, the workers write to it too */
+        if (metrics_socket && metrics_setup(metrics_socket))
+                return 1;
+
+        if (events_file && events_open(events_file, EVENTS_CAPACITY))
+                return 1;
+
+        if (0 == (startups = load_startups(startups_conf, startups_cache)))
+                return 1;
+
+        profile("-", "config");
+
+        if (daemon_mode)
+                ret = run_daemon(argv + optind, argc - optind);
+        else
+                ret = run_single();
+
+        acct_close();
+        metrics_close();
+        events_close();
+        free_startups(startups);
+
+        return ret;
 }
@@ -0,0 +1,349 @@
+/* -*- mode: c; -*- */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/vt.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "run.h"
+#include "throttle.h"
+
+/* the PAM statuses pam_diag() knows of, and one for the rest */
+#define PAM_STATUSES 33
+
+#define BUCKETS 16
+
+/* upper bounds, in seconds; each histogram has one more for +Inf */
+static const double phase_bounds[] = {
+        0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5,
+        10, 0
+};
+
+static const double session_bounds[] = {
+        60, 300, 900, 1800, 3600, 14400, 28800, 86400, 0
+};
+
+/* the phases worth a histogram, by their trace names */
+static const char *phase_names[TRACE_PHASES] = {
+        [TRACE_PAM_START]        = "pam_start",
+        [TRACE_PAM_AUTHENTICATE] = "pam_authenticate",
+        [TRACE_PAM_ACCT_MGMT]    = "pam_acct_mgmt",
+        [TRACE_PAM_SETCRED]      = "pam_setcred",
+        [TRACE_PAM_OPEN_SESSION] = "pam_open_session",
+};
+
+/* the count is the sum of the buckets, it cannot be seen out of step */
+struct histogram_t {
+        unsigned long buckets[BUCKETS];
+        unsigned long long sum;
+};
+
+struct metrics_t {
+        unsigned long counters[METRICS];
+        unsigned long failures[PAM_STATUSES];
+
+        struct histogram_t phases[TRACE_PHASES];
+        struct histogram_t sessions;
+
+        long active[MAX_NR_CONSOLES + 1];
+};
+
+static struct metrics_t *metrics;
+static const char *metrics_path;
+static int listen_fd = -1;
+
+static void
+add(unsigned long *p, unsigned long n)
+{
+        __atomic_fetch_add(p, n, __ATOMIC_RELAXED);
+}
+
+static unsigned long
+get(unsigned long *p)
+{
+        return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static void
+observe(struct histogram_t *h, const double *bounds, long long ns)
+{
+        size_t i;
+
+        for (i = 0; bounds[i] && ns > bounds[i] * 1e9; ++i) ;
+
+        add(h->buckets + i, 1);
+        __atomic_fetch_add(&h->sum, ns, __ATOMIC_RELAXED);
+}
+
+/* serial lines, ttyS0 being minor 64, are counted under VT 0 */
+static long *
+active(int vt)
+{
+        return metrics->active + (0 < vt && vt <= MAX_NR_CONSOLES ? vt : 0);
+}
+
+static void
+print_histogram(FILE *fp, const char *name, const char *labels,
+                struct histogram_t *h, const double *bounds)
+{
+        unsigned long count = 0;
+        size_t i;
+
+        for (i = 0; bounds[i]; ++i) {
+                count += get(h->buckets + i);
+                fprintf(fp, "%s_bucket{%s%sle=\"%g\"} %lu\n",
+                        name, labels, *labels ? "," : "", bounds[i], count);
+        }
+
+        count += get(h->buckets + i);
+        fprintf(fp, "%s_bucket{%s%sle=\"+Inf\"} %lu\n",
+                name, labels, *labels ? "," : "", count);
+
+        fprintf(fp, "%s_sum%s%s%s %.9f\n", name,
+                *labels ? "{" : "", labels, *labels ? "}" : "",
+                __atomic_load_n(&h->sum, __ATOMIC_RELAXED) / 1e9);
+        fprintf(fp, "%s_count%s%s%s %lu\n", name,
+                *labels ? "{" : "", labels, *labels ? "}" : "", count);
+}
+
+static void
+print_counter(FILE *fp, const char *name, const char *help,
+              unsigned long value)
+{
+        fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n",
+                name, help, name, name, value);
+}
+
+static void
+print_metrics(FILE *fp)
+{
+        unsigned long *c = metrics->counters;
+        char labels[64];
+        size_t i;
+
+        print_counter(fp, "logitty_login_attempts_total",
+                      "Logins submitted.", get(c + METRIC_LOGIN_ATTEMPTS));
+        print_counter(fp, "logitty_login_successes_total",
+                      "Logins authenticated.",
+                      get(c + METRIC_LOGIN_SUCCESSES));
+        print_counter(fp, "logitty_login_cancelled_total",
+                      "Logins cancelled or whose worker died.",
+                      get(c + METRIC_LOGIN_CANCELLED));
+
+        fprintf(fp, "# HELP logitty_login_failures_total "
+                "Logins failed, by PAM status.\n"
+                "# TYPE logitty_login_failures_total counter\n");
+        for (i = 0; i < PAM_STATUSES; ++i) {
+                if (0 == get(metrics->failures + i))
+                        continue;
+
+                if (PAM_STATUSES - 1 == i)
+                        fprintf(fp, "logitty_login_failures_total"
+                                "{code=\"other\",error=\"%s\"} %lu\n",
+                                run_diag(-1), get(metrics->failures + i));
+                else
+                        fprintf(fp, "logitty_login_failures_total"
+                                "{code=\"%zu\",error=\"%s\"} %lu\n",
+                                i, run_diag(i), get(metrics->failures + i));
+        }
+
+        print_counter(fp, "logitty_throttle_rejected_total",
+                      "Logins refused by the throttle.",
+                      throttle_stats.rejected);
+        print_counter(fp, "logitty_throttle_delayed_total",
+                      "Logins held back by the throttle.",
+                      throttle_stats.delayed);
+
+        fprintf(fp, "# HELP logitty_pam_phase_seconds "
+                "Time spent in each PAM call.\n"
+                "# TYPE logitty_pam_phase_seconds histogram\n");
+        for (i = 0; i < TRACE_PHASES; ++i) {
+                if (0 == phase_names[i])
+                        continue;
+
+                snprintf(labels, sizeof labels, "phase=\"%s\"",
+                         phase_names[i]);
+                print_histogram(fp, "logitty_pam_phase_seconds", labels,
+                                metrics->phases + i, phase_bounds);
+        }
+
+        fprintf(fp, "# HELP logitty_session_duration_seconds "
+                "Lifetime of the sessions that have ended.\n"
+                "# TYPE logitty_session_duration_seconds histogram\n");
+        print_histogram(fp, "logitty_session_duration_seconds", "",
+                        &metrics->sessions, session_bounds);
+
+        /* VT 0 stands for a terminal that is not one, a serial line */
+        fprintf(fp, "# HELP logitty_sessions_active "
+                "Sessions running, by VT.\n"
+                "# TYPE logitty_sessions_active gauge\n");
+        for (i = 0; i <= MAX_NR_CONSOLES; ++i) {
+                long n = __atomic_load_n(metrics->active + i, __ATOMIC_RELAXED);
+
+                if (n)
+                        fprintf(fp, "logitty_sessions_active{vt=\"%zu\"} %ld\n",
+                                i, n);
+        }
+
+        print_counter(fp, "logitty_redraws_total",
+                      "Screen updates.", get(c + METRIC_REDRAWS));
+        print_counter(fp, "logitty_redraw_bytes_total",
+                      "Bytes sent to the terminals by screen updates.",
+                      get(c + METRIC_REDRAW_BYTES));
+}
+
+/**********************************************************************/
+
+int metrics_setup(const char *path)
+{
+        struct sockaddr_un addr;
+        void *p;
+
+        memset(&addr, 0, sizeof addr);
+        addr.sun_family = AF_UNIX;
+
+        if (sizeof addr.sun_path <= strlen(path)) {
+                fprintf(stderr, "metrics : socket path too long\n");
+                return 1;
+        }
+
+        strcpy(addr.sun_path, path);
+
+        p = mmap(0, sizeof *metrics, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == p) {
+                fprintf(stderr, "metrics : %s\n", strerror(errno));
+                return 1;
+        }
+
+        /* a socket left behind by a previous instance */
+        unlink(path);
+
+        if (0 > (listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+                                    SOCK_CLOEXEC, 0)) ||
+            bind(listen_fd, (struct sockaddr *)&addr, sizeof addr) ||
+            listen(listen_fd, 8)) {
+                fprintf(stderr, "metrics : %s : %s\n", path, strerror(errno));
+
+                if (0 <= listen_fd)
+                        close(listen_fd);
+                listen_fd = -1;
+
+                munmap(p, sizeof *metrics);
+                return 1;
+        }
+
+        metrics = p;
+        metrics_path = path;
+
+        return 0;
+}
+
+void metrics_close()
+{
+        if (0 > listen_fd)
+                return;
+
+        close(listen_fd);
+        unlink(metrics_path);
+
+        listen_fd = -1;
+}
+
+/* what serve() polls for, -1 without a socket */
+int metrics_fd()
+{
+        return listen_fd;
+}
+
+/*
+ * Writes the metrics to each client waiting and hangs up. They are a few
+ * kilobytes, well within a socket's buffer, so a client that does not read
+ * cannot hold us up.
+ */
+void metrics_serve()
+{
+        char *buf;
+        size_t size;
+        FILE *fp;
+        int fd;
+
+        while (0 <= (fd = accept4(listen_fd, 0, 0, SOCK_CLOEXEC))) {
+                buf = 0;
+
+                if ((fp = open_memstream(&buf, &size))) {
+                        print_metrics(fp);
+                        fclose(fp);
+
+                        if (0 > send(fd, buf, size,
+                                     MSG_DONTWAIT | MSG_NOSIGNAL))
+                                fprintf(stderr, "metrics : %s\n",
+                                        strerror(errno));
+                }
+
+                free(buf);
+                close(fd);
+        }
+}
+
+long long metrics_clock()
+{
+        struct timespec ts;
+
+        if (0 == metrics)
+                return 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void metrics_add(enum metric_t metric, unsigned long n)
+{
+        if (metrics)
+                add(metrics->counters + metric, n);
+}
+
+/* a login that has failed with the PAM status */
+void metrics_failure(int status)
+{
+        if (0 == metrics)
+                return;
+
+        if (0 > status || PAM_STATUSES - 1 <= status)
+                status = PAM_STATUSES - 1;
+
+        add(metrics->failures + status, 1);
+}
+
+/* a PAM call, started at since by metrics_clock() */
+void metrics_phase(enum trace_phase_t phase, long long since)
+{
+        if (metrics && phase_names[phase])
+                observe(metrics->phases + phase, phase_bounds,
+                        metrics_clock() - since);
+}
+
+void metrics_session_open(int vt)
+{
+        if (metrics)
+                __atomic_fetch_add(active(vt), 1, __ATOMIC_RELAXED);
+}
+
+void metrics_session_close(int vt, long long since)
+{
+        if (0 == metrics)
+                return;
+
+        __atomic_fetch_sub(active(vt), 1, __ATOMIC_RELAXED);
+
+        observe(&metrics->sessions, session_bounds, metrics_clock() - since);
+}
@@ -0,0 +1,40 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_METRICS_H
+#define TUI_METRICS_H
+
+#include "trace.h"
+
+/*
+ * Counters and histograms, served in the Prometheus text format to whoever
+ * connects to the metrics socket. They live in a shared mapping made before
+ * any fork, so that the workers record their PAM phases in place, and are
+ * updated with relaxed atomics, never under a lock. Without a socket, every
+ * call below returns at once.
+ */
+enum metric_t {
+        METRIC_LOGIN_ATTEMPTS,
+        METRIC_LOGIN_SUCCESSES,
+        METRIC_LOGIN_CANCELLED,
+        METRIC_REDRAWS,
+        METRIC_REDRAW_BYTES,
+
+        METRICS
+};
+
+int metrics_setup(const char *path);
+void metrics_close();
+
+int metrics_fd();
+void metrics_serve();
+
+long long metrics_clock();
+
+void metrics_add(enum metric_t metric, unsigned long n);
+void metrics_failure(int status);
+void metrics_phase(enum trace_phase_t phase, long long since);
+
+void metrics_session_open(int vt);
+void metrics_session_close(int vt, long long since);
+
+#endif /* TUI_METRICS_H */
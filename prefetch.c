@@ -0,0 +1,345 @@
+/* -*- mode: c; -*- */
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/ioprio.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "launch.h"
+#include "prefetch.h"
+
+#define MAX_FILES 256
+#define MAX_DIRS  16
+
+/* where libraries are looked for after the RUNPATH and the loader's own */
+static const char *lib_dirs[] = {
+        "/lib64", "/usr/lib64", "/lib", "/usr/lib", "/usr/local/lib", 0
+};
+
+struct walk_t {
+        char *files[MAX_FILES];
+        size_t nfiles;
+
+        char *dirs[MAX_DIRS];
+        size_t ndirs;
+
+        /* bytes we may still read */
+        long left;
+};
+
+static pid_t helper;
+
+static void
+add_file(struct walk_t *w, const char *path)
+{
+        char buf[PATH_MAX];
+        size_t i;
+
+        if (MAX_FILES == w->nfiles || 0 == realpath(path, buf))
+                return;
+
+        for (i = 0; i < w->nfiles; ++i) {
+                if (0 == strcmp(w->files[i], buf))
+                        return;
+        }
+
+        if ((w->files[w->nfiles] = strdup(buf)))
+                ++w->nfiles;
+}
+
+static void
+add_dir(struct walk_t *w, const char *dir)
+{
+        size_t i;
+
+        /* $ORIGIN and the like are not worth expanding here */
+        if (MAX_DIRS == w->ndirs || strchr(dir, '$') || '/' != *dir)
+                return;
+
+        for (i = 0; i < w->ndirs; ++i) {
+                if (0 == strcmp(w->dirs[i], dir))
+                        return;
+        }
+
+        if ((w->dirs[w->ndirs] = strdup(dir)))
+                ++w->ndirs;
+}
+
+static void
+add_library(struct walk_t *w, const char *name)
+{
+        char buf[PATH_MAX];
+        const char **pp;
+        size_t i;
+
+        if (strchr(name, '/')) {
+                add_file(w, name);
+                return;
+        }
+
+        for (i = 0; i < w->ndirs; ++i) {
+                snprintf(buf, sizeof buf, "%s/%s", w->dirs[i], name);
+                if (0 == access(buf, F_OK)) {
+                        add_file(w, buf);
+                        return;
+                }
+        }
+
+        for (pp = lib_dirs; *pp; ++pp) {
+                snprintf(buf, sizeof buf, "%s/%s", *pp, name);
+                if (0 == access(buf, F_OK)) {
+                        add_file(w, buf);
+                        return;
+                }
+        }
+}
+
+/* the interpreter of a script */
+static void
+scan_script(struct walk_t *w, const char *map, size_t size)
+{
+        char buf[256];
+        size_t n;
+
+        for (map += 2, size -= 2; size && (' ' == *map || '\t' == *map);
+             ++map, --size) ;
+
+        for (n = 0; n < size && n < sizeof buf - 1 && !strchr(" \t\n", map[n]);
+             ++n)
+                buf[n] = map[n];
+
+        buf[n] = 0;
+
+        if (n)
+                add_file(w, buf);
+}
+
+/* where in the file the address is, 0 if nowhere */
+static size_t
+file_offset(const Elf64_Phdr *ph, size_t n, Elf64_Addr addr)
+{
+        size_t i;
+
+        for (i = 0; i < n; ++i) {
+                if (PT_LOAD == ph[i].p_type && ph[i].p_vaddr <= addr &&
+                    addr < ph[i].p_vaddr + ph[i].p_filesz)
+                        return addr - ph[i].p_vaddr + ph[i].p_offset;
+        }
+
+        return 0;
+}
+
+/* the loader, the RUNPATH and the DT_NEEDED libraries of an ELF file */
+static void
+scan_elf(struct walk_t *w, const char *map, size_t size)
+{
+        const Elf64_Ehdr *eh = (const Elf64_Ehdr *)map;
+        const Elf64_Phdr *ph;
+        const Elf64_Dyn *dyn = 0;
+        const char *s;
+        char buf[PATH_MAX], loader[PATH_MAX], *dir, *save;
+        size_t i, ndyn = 0, strtab = 0;
+
+        if (sizeof *eh > size || ELFCLASS64 != eh->e_ident[EI_CLASS] ||
+            eh->e_phoff + eh->e_phnum * sizeof *ph > size)
+                return;
+
+        ph = (const Elf64_Phdr *)(map + eh->e_phoff);
+
+        for (i = 0; i < eh->e_phnum; ++i) {
+                if (ph[i].p_offset + ph[i].p_filesz > size)
+                        continue;
+
+                if (PT_INTERP == ph[i].p_type &&
+                    ph[i].p_filesz < sizeof buf) {
+                        memcpy(buf, map + ph[i].p_offset, ph[i].p_filesz);
+                        buf[ph[i].p_filesz] = 0;
+
+                        add_file(w, buf);
+
+                        /* the libc is where the loader is */
+                        if (realpath(buf, loader))
+                                add_dir(w, dirname(loader));
+                }
+                else if (PT_DYNAMIC == ph[i].p_type) {
+                        dyn = (const Elf64_Dyn *)(map + ph[i].p_offset);
+                        ndyn = ph[i].p_filesz / sizeof *dyn;
+                }
+        }
+
+        for (i = 0; i < ndyn && DT_NULL != dyn[i].d_tag; ++i) {
+                if (DT_STRTAB == dyn[i].d_tag)
+                        strtab = file_offset(ph, eh->e_phnum, dyn[i].d_un.d_ptr);
+        }
+
+        if (0 == strtab || strtab >= size)
+                return;
+
+        for (i = 0; i < ndyn && DT_NULL != dyn[i].d_tag; ++i) {
+                if ((DT_RUNPATH != dyn[i].d_tag && DT_RPATH != dyn[i].d_tag) ||
+                    strtab + dyn[i].d_un.d_val >= size)
+                        continue;
+
+                s = map + strtab + dyn[i].d_un.d_val;
+                snprintf(buf, sizeof buf, "%.*s",
+                         (int)strnlen(s, size - strtab - dyn[i].d_un.d_val), s);
+
+                for (dir = strtok_r(buf, ":", &save); dir;
+                     dir = strtok_r(0, ":", &save))
+                        add_dir(w, dir);
+        }
+
+        for (i = 0; i < ndyn && DT_NULL != dyn[i].d_tag; ++i) {
+                if (DT_NEEDED != dyn[i].d_tag ||
+                    strtab + dyn[i].d_un.d_val >= size)
+                        continue;
+
+                s = map + strtab + dyn[i].d_un.d_val;
+                if (strnlen(s, size - strtab - dyn[i].d_un.d_val) <
+                    size - strtab - dyn[i].d_un.d_val)
+                        add_library(w, s);
+        }
+}
+
+/* reads the file ahead, and finds what it needs in turn */
+static void
+warm(struct walk_t *w, const char *path)
+{
+        struct stat st;
+        const char *map;
+        int fd;
+
+        if (0 > (fd = open(path, O_RDONLY | O_CLOEXEC)))
+                return;
+
+        if (fstat(fd, &st) || !S_ISREG(st.st_mode) || 0 == st.st_size) {
+                close(fd);
+                return;
+        }
+
+        readahead(fd, 0, st.st_size < w->left ? st.st_size : w->left);
+        w->left -= st.st_size;
+
+        map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED != map) {
+                if (2 < st.st_size && '#' == map[0] && '!' == map[1])
+                        scan_script(w, map, st.st_size);
+                else if (SELFMAG < st.st_size &&
+                         0 == memcmp(map, ELFMAG, SELFMAG))
+                        scan_elf(w, map, st.st_size);
+
+                munmap((void *)map, st.st_size);
+        }
+
+        close(fd);
+}
+
+static void
+add_extra(struct walk_t *w, char **extra)
+{
+        char *buf, *pattern, *save;
+        glob_t g;
+        size_t i;
+
+        for (; extra && *extra; ++extra) {
+                if (0 == (buf = strdup(*extra)))
+                        continue;
+
+                for (pattern = strtok_r(buf, " \t", &save); pattern;
+                     pattern = strtok_r(0, " \t", &save)) {
+                        if (glob(pattern, GLOB_NOSORT, 0, &g))
+                                continue;
+
+                        for (i = 0; i < g.gl_pathc; ++i)
+                                add_file(w, g.gl_pathv[i]);
+
+                        globfree(&g);
+                }
+
+                free(buf);
+        }
+}
+
+static void
+run_helper(const char *program, char **extra, long limit)
+{
+        struct walk_t w;
+        char *path;
+        size_t i;
+
+        /* after everything else, on the CPU and on the disk */
+        setpriority(PRIO_PROCESS, 0, 19);
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0));
+
+        memset(&w, 0, sizeof w);
+        w.left = limit;
+
+        if ((path = launch_resolve(program))) {
+                add_file(&w, path);
+                free(path);
+        }
+
+        add_extra(&w, extra);
+
+        for (i = 0; i < w.nfiles && 0 < w.left; ++i)
+                warm(&w, w.files[i]);
+
+        _exit(0);
+}
+
+/**********************************************************************/
+
+void prefetch(const char *program, char **extra, long limit)
+{
+        /* what the last one was warming is not wanted any longer */
+        if (helper)
+                kill(helper, SIGKILL);
+
+        helper = fork();
+        if (0 == helper)
+                run_helper(program, extra, limit);
+
+        if (0 > helper) {
+                fprintf(stderr, "fork : %s\n", strerror(errno));
+                helper = 0;
+        }
+}
+
+/* the helper is not to be killed once its pid is free again */
+void prefetch_reaped(pid_t pid)
+{
+        if (pid == helper)
+                helper = 0;
+}
+
+/* a size in bytes, with an optional K, M or G */
+long prefetch_parse_limit(const char *s)
+{
+        char *end;
+        long n;
+
+        n = strtol(s, &end, 10);
+
+        switch (*end) {
+        case 'G': case 'g': n <<= 10; /* fall through */
+        case 'M': case 'm': n <<= 10; /* fall through */
+        case 'K': case 'k': n <<= 10; break;
+        default: break;
+        }
+
+        return 0 < n ? n : PREFETCH_LIMIT;
+}
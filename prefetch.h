@@ -0,0 +1,21 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_PREFETCH_H
+#define TUI_PREFETCH_H
+
+#include <sys/types.h>
+
+/*
+ * Warms the page cache for a startup entry while the user is still typing:
+ * a helper at idle IO priority reads ahead the program, its interpreter,
+ * the libraries it needs, theirs, and the entry's extra files, up to limit
+ * bytes in all. One helper runs at a time, a new prefetch replaces it.
+ */
+#define PREFETCH_LIMIT (128L << 20)
+
+void prefetch(const char *program, char **extra, long limit);
+void prefetch_reaped(pid_t pid);
+
+long prefetch_parse_limit(const char *s);
+
+#endif /* TUI_PREFETCH_H */
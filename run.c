@@ -3,11 +3,11 @@
 #include <assert.h>
 #include <errno.h>
 #include <pwd.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <utmp.h>
 
 #include <grp.h>
 #include <sys/types.h>
@@ -16,7 +16,17 @@
 
 #include <security/pam_appl.h>
 
+#include "acct.h"
+#include "cache.h"
+#include "cgroup.h"
+#include "events.h"
+#include "hooks.h"
+#include "launch.h"
+#include "metrics.h"
 #include "run.h"
+#include "trace.h"
+#include "users.h"
+#include "vt.h"
 
 #define UNUSED(x) ((void)(x))
 
@@ -49,6 +59,7 @@ pam_conv(int n,
                         break;
 
                 case PAM_PROMPT_ECHO_OFF:
+                        /* PAM takes the reply over, wipes and frees it */
                         password = ((char **)data)[1];
                         (*reply)[i].resp = strdup(password);
                         break;
@@ -126,99 +137,133 @@ pam_diag(size_t n)
 }
 
 static int
-do_setup_env(const char *var, const char *value, int overwrite, int strict)
+do_pam(struct pam_handle *pamh, pam_action_t action, int flags, int phase)
 {
-        if (setenv(var, value, overwrite)) {
-                if (strict) {
-                        fprintf(stderr, "failed to setenv %s=%s\n", var, value);
-                        return 1;
-                }
-        }
+        long long t = metrics_clock();
+        int status;
 
-        return 0;
-}
+        TRACE_START(phase);
+        status = action(pamh, flags);
+        TRACE_STOP(phase);
 
-static int
-setup_env_bare(const struct passwd* pwd)
-{
-        const char *s;
+        metrics_phase(phase, t);
 
-        s = getenv("TERM");
-        if (0 == s || 0 == s[0])
-                s = "linux";
+        return status;
+}
 
-        if (do_setup_env("TERM", s, 1, 1))
-                return 1;
+/*
+ * The conversation reads the credentials at call time, which lets the handle
+ * be started long before the user has typed them.
+ */
+static const char *creds[2];
+static const struct pam_conv pamc = { pam_conv, creds };
 
-        s = getenv("LANG");
-        if (0 == s || 0 == s[0])
-                s = "C";
+/* an alternative to /etc/pam.d, for testing */
+static const char *pam_confdir;
 
-        if (do_setup_env("LANG", s, 1, 1))
-                return 1;
+static int
+do_pam_start(struct pam_handle **pamh)
+{
+        long long t = metrics_clock();
+        int status;
 
-        if (do_setup_env("HOME",    pwd->pw_dir,   1, 1) ||
-            do_setup_env("PWD",     pwd->pw_dir,   1, 1) ||
-            do_setup_env("SHELL",   pwd->pw_shell, 1, 1) ||
-            do_setup_env("USER",    pwd->pw_name,  1, 1) ||
-            do_setup_env("LOGNAME", pwd->pw_name,  1, 1)) {
-                return 1;
-        }
+        TRACE_START(TRACE_PAM_START);
+        if (pam_confdir)
+                status = pam_start_confdir(
+                        "logitty", 0, &pamc, pam_confdir, pamh);
+        else
+                status = pam_start("logitty", 0, &pamc, pamh);
+        TRACE_STOP(TRACE_PAM_START);
 
-        return do_setup_env("PATH", "/usr/local/sbin:/usr/bin:/bin", 1, 1);
+        metrics_phase(TRACE_PAM_START, t);
+
+        return status;
 }
 
+/*
+ * Authenticates the user and opens the PAM session. With verify, only
+ * checks that the user may log in, and ends the handle. A user whose
+ * password has been checked against the cache skips pam_authenticate.
+ */
 static int
-setup_env_pam(char **envs)
+setup_pam(struct pam_handle **ppamh,
+          const char *username, const char *password, int verify,
+          int cached)
 {
-        for (char** env = envs; *env; ++env) {
-                if (putenv(*env)) {
-                        fprintf(stderr, "putenv fail : %s\n", strerror(errno));
-                        return 1;
-                }
+        struct pam_handle *pamh = *ppamh;
+        int status, ret;
+
+        creds[0] = username;
+        creds[1] = password;
+
+        if ((0 == pamh &&
+             PAM_SUCCESS != (status = do_pam_start(&pamh))) ||
+            PAM_SUCCESS != (status = pam_set_item(pamh, PAM_USER, username)) ||
+            (!cached &&
+             PAM_SUCCESS != (status = do_pam(
+                                     pamh, pam_authenticate, 0,
+                                     TRACE_PAM_AUTHENTICATE))) ||
+            PAM_SUCCESS != (status = do_pam(
+                                    pamh, pam_acct_mgmt, 0,
+                                    TRACE_PAM_ACCT_MGMT))) {
+                fprintf(stderr, "PAM : %s\n", pam_diag(status));
+                goto err;
         }
 
-        return 0;
-}
-
-static struct pam_handle *
-setup_pam(const char *username, const char *password)
-{
-        struct pam_handle *pamh = 0;
-
-        const char* creds[] = { username, password };
-        struct pam_conv pamc = { pam_conv, creds };
-
-        int status;
+        /* the user has a session already, the handle is done with */
+        if (verify)
+                goto err;
 
-        if (PAM_SUCCESS != (status = pam_start("logitty", 0, &pamc, &pamh)) ||
-            PAM_SUCCESS != (status = pam_authenticate(pamh, 0)) ||
-            PAM_SUCCESS != (status = pam_acct_mgmt(pamh, 0)) ||
-            PAM_SUCCESS != (status = pam_setcred(pamh, PAM_ESTABLISH_CRED))) {
+        if (PAM_SUCCESS != (status = do_pam(
+                                    pamh, pam_setcred, PAM_ESTABLISH_CRED,
+                                    TRACE_PAM_SETCRED))) {
                 fprintf(stderr, "PAM : %s\n", pam_diag(status));
                 goto err;
         }
 
-        if (PAM_SUCCESS != (status = pam_open_session(pamh, 0))) {
+        if (PAM_SUCCESS != (status = do_pam(
+                                    pamh, pam_open_session, 0,
+                                    TRACE_PAM_OPEN_SESSION))) {
                 fprintf(stderr, "PAM : %s\n", pam_diag(status));
                 goto nosession;
         }
 
-        return pamh;
+        creds[0] = creds[1] = 0;
+        *ppamh = pamh;
+
+        return PAM_SUCCESS;
 
 nosession:
-        if (PAM_SUCCESS != (status = pam_setcred(pamh, PAM_DELETE_CRED))) {
-                fprintf(stderr, "PAM : %s\n", pam_diag(status));
+        if (PAM_SUCCESS != (ret = pam_setcred(pamh, PAM_DELETE_CRED))) {
+                fprintf(stderr, "PAM : %s\n", pam_diag(ret));
         }
 
 err:
+        creds[0] = creds[1] = 0;
+
         if (pamh) {
-                if (PAM_SUCCESS != (status = pam_end(pamh, 0))) {
-                        fprintf(stderr, "PAM : %s\n", pam_diag(status));
+                if (PAM_SUCCESS != (ret = pam_end(pamh, status))) {
+                        fprintf(stderr, "PAM : %s\n", pam_diag(ret));
                 }
         }
 
-        return 0;
+        *ppamh = 0;
+
+        return status;
+}
+
+/* the outcome of a login attempt, with its phases */
+static void
+log_event(enum event_type_t type, struct acct_t *acct, const char *username,
+          uid_t uid, int status)
+{
+        unsigned int phases[TRACE_PHASES] = { 0 };
+
+        if (!events_enabled())
+                return;
+
+        TRACE_DURATIONS(phases);
+        events_log(type, acct->line, username, uid, status, phases);
 }
 
 static int
@@ -239,128 +284,323 @@ destroy_pam(struct pam_handle *pamh)
         return 0;
 }
 
+/*
+ * How a session has ended, the way a shell has it: its exit status, or 128
+ * and the signal that has killed it. 127 is a session that could not start.
+ */
 static int
-register_utmp(struct utmp *p, const char *username, pid_t pid)
+exit_code(int status)
 {
-        const char *s;
-        int ret = 1;
+        if (WIFSIGNALED(status))
+                return 128 + WTERMSIG(status);
 
-	p->ut_type = USER_PROCESS;
-	p->ut_pid = pid;
+        return WEXITSTATUS(status);
+}
 
-        s = ttyname(STDIN_FILENO);
-        if (sizeof(p->ut_line) < strlen(s) - strlen("/dev/") + 1) {
-                fprintf(stderr, "insufficient space (utmp::ut_line)\n");
-                return ret;
-        }
-	strcpy(p->ut_line, s + strlen("/dev/"));
+static long long
+now_ms()
+{
+        struct timespec ts;
 
-        if (sizeof(p->ut_id) < strlen(s) - strlen("/dev/tty") + 1) {
-                fprintf(stderr, "insufficient space (utmp::ut_id)\n");
-                return ret;
-        }
-	strcpy(p->ut_id, ttyname(STDIN_FILENO) + strlen("/dev/tty"));
+        clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	time((long int *)&p->ut_time);
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
 
-        if (sizeof(p->ut_user) < strlen(username) + 1) {
-                fprintf(stderr, "insufficient space (utmp::ut_user)\n");
-                return ret;
-        }
-	strncpy(p->ut_user, username, UT_NAMESIZE);
+/* on the log, and on the terminal for the user waiting in front of it */
+static void
+say(const char *msg, int code, int delay)
+{
+        char buf[128], what[64];
 
-	memset(p->ut_host, 0, UT_HOSTSIZE);
-	p->ut_addr = 0;
+        run_ending(code, what, sizeof what);
 
-	setutent();
-	if ((ret = !pututline(p)))
-                fprintf(stderr, "pututline fail : %s\n", strerror(errno));
-        endutent();
+        if (delay)
+                snprintf(buf, sizeof buf, "%s, %s in %ds", what, msg, delay);
+        else
+                snprintf(buf, sizeof buf, "%s, %s", what, msg);
+
+        fprintf(stderr, "%s\n", buf);
+        dprintf(STDOUT_FILENO, "\r\nlogitty: %s\r\n", buf);
+}
 
-        return ret;
+/* killed by someone who meant it, not crashed */
+static int
+stopped(int code)
+{
+        return 128 + SIGTERM == code || 128 + SIGHUP == code ||
+                128 + SIGKILL == code;
 }
 
+/*
+ * Waits for the session, and starts it again when it crashes on start:
+ * when it fails within RESTART_STABLE seconds, up to login->restarts times
+ * in a row, after 1, 2, 4... seconds. Once the restarts are used up, or
+ * straight away if the session cannot start at all, the fallback entry gets
+ * a single go. A session that has run longer, has been stopped or has
+ * exited with 0 is over. Returns how the last session has ended, as
+ * exit_code() has it.
+ */
 static int
-unregister_utmp(struct utmp *p)
+supervise(struct launch_t *l, struct cgroup_t *cg, struct login_t *login,
+          struct acct_t *acct, pid_t pid)
 {
-        int ret;
+        long long start;
+        int status, code, tries = 0, fallen = 0, delay;
 
-	p->ut_type = DEAD_PROCESS;
-	memset(p->ut_line, 0, UT_LINESIZE);
+        for (;;) {
+                start = now_ms();
+
+                if (0 > pid)
+                        code = 127;
+                else {
+                        waitpid(pid, &status, 0);
+                        code = exit_code(status);
+                }
 
-	p->ut_time = 0;
-	memset(p->ut_user, 0, UT_NAMESIZE);
+                if (0 == code || fallen || stopped(code) ||
+                    now_ms() - start >= RESTART_STABLE * 1000)
+                        return code;
 
-        setutent();
-	if ((ret = !pututline(p)))
-                fprintf(stderr, "pututline fail : %s\n", strerror(errno));
-	endutent();
+                /* whatever the failed session has left would be in the way */
+                cgroup_clear(cg);
 
-        return ret;
+                if (127 != code && tries < login->restarts) {
+                        delay = RESTART_DELAY << tries;
+                        if (delay > RESTART_MAX_DELAY)
+                                delay = RESTART_MAX_DELAY;
+
+                        say("restarting", code, delay);
+                        sleep(delay);
+
+                        ++tries;
+                }
+                else if (login->fallback) {
+                        say("starting the fallback", code, 0);
+
+                        if (launch_target(l, login->fallback))
+                                return 127;
+
+                        fallen = 1;
+                }
+                else {
+                        return code;
+                }
+
+                /* the record names the process that is running */
+                if (0 < (pid = launch_spawn(l)))
+                        acct_update(acct, pid);
+        }
 }
 
 static int
-do_run(struct passwd *passwd, char **argv, char **envs)
+do_run(struct passwd *passwd, struct login_t *login, char **envs,
+       struct acct_t *acct)
 {
-        int pid, ret, status;
-        struct utmp utmpent;
+        int pid, code = 127;
+        struct launch_t launch;
+        struct cgroup_t cg;
 
-        UNUSED(argv);
+        cgroup_open(&cg, STDIN_FILENO, login->limits);
 
-        if (0 == (pid = fork())) {
-                if (initgroups(passwd->pw_name, passwd->pw_gid)) {
-                        fprintf(stderr, "initgroups : %s\n", strerror(errno));
-                        return 1;
-                }
+        if (launch_prepare(&launch, passwd, login->groups, login->ngroups,
+                           envs))
+                goto err;
 
-                if (setgid(passwd->pw_gid) || setuid(passwd->pw_uid)) {
-                        fprintf(stderr, "setup uid, gid : %s\n", strerror(errno));
-                        return 1;
-                }
+        launch.cgroup = cg.dir;
+
+        /* with a fallback, a session that cannot start is not the end */
+        if (launch_target(&launch, login->argv) && 0 == login->fallback)
+                goto err;
 
-                if (setup_env_bare(passwd) || setup_env_pam(envs))
-                        exit(1);
+        if (*login->hooks)
+                run_hooks(&launch, login->hooks, login->deadline);
 
-                if (chdir(passwd->pw_dir)) {
-                        fprintf(stderr, "cd error : %s\n", strerror(errno));
-                        exit(1);
-                }
+        pid = launch.path ? launch_spawn(&launch) : -1;
+        if (0 > pid && 0 == login->fallback)
+                goto err;
 
-                /* exec some */
-                execvp(argv[0], argv);
+        TRACE_START(TRACE_ACCT_LOGIN);
+        acct_login(acct, passwd->pw_name, passwd->pw_uid,
+                   0 < pid ? pid : getpid());
+        TRACE_STOP(TRACE_ACCT_LOGIN);
 
-                exit(0);
-        }
+        TRACE_END(passwd->pw_name, 0);
+        log_event(EVENT_LOGIN, acct, passwd->pw_name, passwd->pw_uid, 0);
 
-        ret = register_utmp(&utmpent, passwd->pw_name, pid);
-        waitpid(pid, &status, 0);
+        code = supervise(&launch, &cg, login, acct, pid);
+        launch_free(&launch);
 
-        if (0 == ret)
-                unregister_utmp(&utmpent);
+        acct_logout(acct);
+        events_log(EVENT_LOGOUT, acct->line, passwd->pw_name, passwd->pw_uid,
+                   code, 0);
 
-        return status;
+        /* takes down whatever the session has left behind */
+        cgroup_close(&cg, passwd->pw_name);
+
+        return code;
+
+err:
+        TRACE_END(passwd->pw_name, 1);
+        log_event(EVENT_FAILURE, acct, passwd->pw_name, passwd->pw_uid, -1);
+        launch_free(&launch);
+        cgroup_close(&cg, 0);
+
+        return code;
 }
 
 /**********************************************************************/
 
-int run(const char *username, char *password, char **argv)
+void run_set_pam_confdir(const char *dir)
 {
+        pam_confdir = dir;
+}
+
+/*
+ * Starts a PAM handle ahead of the login: parsing the service configuration
+ * and loading the modules is paid for while the user is still typing.
+ */
+struct pam_handle *prepare_pam()
+{
+        struct pam_handle *pamh = 0;
+        int status;
+
+        if (PAM_SUCCESS != (status = do_pam_start(&pamh))) {
+                fprintf(stderr, "PAM : %s\n", pam_diag(status));
+                return 0;
+        }
+
+        return pamh;
+}
+
+void discard_pam(struct pam_handle *pamh)
+{
+        if (pamh)
+                pam_end(pamh, PAM_SUCCESS);
+}
+
+static void
+notify(int fd, int status, const char *verifier)
+{
+        struct notice_t notice;
+
+        if (0 > fd)
+                return;
+
+        memset(&notice, 0, sizeof notice);
+
+        notice.status = status;
+        if (verifier)
+                strcpy(notice.verifier, verifier);
+
+        if (sizeof notice != write(fd, &notice, sizeof notice))
+                fprintf(stderr, "notify : %s\n", strerror(errno));
+
+        explicit_bzero(&notice, sizeof notice);
+}
+
+/*
+ * Authenticates the user and runs the session, reporting over fd (if not
+ * negative) 0 once the session is starting or the error status otherwise.
+ */
+int run(struct pam_handle *pamh, struct acct_t *acct,
+        struct login_t *login, int fd)
+{
+        const char *username = login->username;
+        char *password = login->password;
         struct passwd *passwd;
-        struct pam_handle *pamh;
+        struct user_t user;
+        sigset_t mask;
+        int status, cached = 0;
+
+        /* most likely looked up while the password was being typed */
+        TRACE_START(TRACE_GETPWNAM);
+        if (0 == users_find(username, &user)) {
+                passwd = &user.pw;
+                login->groups = user.groups;
+                login->ngroups = user.ngroups;
+        }
+        else {
+                passwd = getpwnam(username);
+        }
+        TRACE_STOP(TRACE_GETPWNAM);
 
-        passwd = getpwnam(username);
         if (0 == passwd || 0 == passwd->pw_shell || 0 == *passwd->pw_shell) {
                 fprintf(stderr, "getpwnam error : %s\n", strerror(errno));
+                TRACE_END(username, 1);
+                log_event(EVENT_FAILURE, acct, username, -1,
+                          PAM_USER_UNKNOWN);
+                explicit_bzero(password, strlen(password));
+                discard_pam(pamh);
+                notify(fd, PAM_USER_UNKNOWN, 0);
                 return 1;
         }
 
-        if (0 == (pamh = setup_pam(username, password)))
+        /* a recent login's password is checked here, not by the stack */
+        if (*login->verifier) {
+                TRACE_START(TRACE_CACHE_CHECK);
+                cached = cache_check(password, login->verifier);
+                TRACE_STOP(TRACE_CACHE_CHECK);
+
+                explicit_bzero(login->verifier, sizeof login->verifier);
+        }
+
+        status = setup_pam(&pamh, username, password, login->verify, cached);
+
+        if (PAM_SUCCESS == status && login->cache && !cached) {
+                TRACE_START(TRACE_CACHE_MAKE);
+                cache_make(password, login->verifier);
+                TRACE_STOP(TRACE_CACHE_MAKE);
+        }
+
+        /* the only copy we have, PAM is done with it */
+        explicit_bzero(password, strlen(password));
+
+        if (PAM_SUCCESS != status) {
+                TRACE_END(username, 1);
+                log_event(EVENT_FAILURE, acct, username, passwd->pw_uid,
+                          status);
+                notify(fd, status, 0);
                 return 1;
+        }
+
+        if (login->verify) {
+                TRACE_END(username, 0);
+                log_event(EVENT_LOGIN, acct, username, passwd->pw_uid, 0);
+                notify(fd, 0, login->verifier);
+                return 0;
+        }
+
+        /* past this point the login can no longer be cancelled */
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTERM);
+        sigprocmask(SIG_BLOCK, &mask, 0);
 
-        memset(password, 0, strlen(password));
+        notify(fd, 0, login->verifier);
+        explicit_bzero(login->verifier, sizeof login->verifier);
 
-        int status = do_run(passwd, argv, pam_getenvlist(pamh));
+        /* a session on a terminal of its own is brought to the front */
+        if (login->vt)
+                vt_activate(STDIN_FILENO, login->vt, 1);
+
+        status = do_run(passwd, login, pam_getenvlist(pamh), acct);
         destroy_pam(pamh);
 
         return status;
 }
+
+const char *run_diag(int status)
+{
+        return pam_diag(status);
+}
+
+void run_ending(int code, char *buf, size_t size)
+{
+        if (127 == code)
+                snprintf(buf, size, "session could not start");
+        else if (128 < code)
+                snprintf(buf, size, "session killed by %s",
+                         strsignal(code - 128));
+        else
+                snprintf(buf, size, "session exited with status %d", code);
+}
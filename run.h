@@ -3,6 +3,66 @@
 #ifndef TUI_RUN_H
 #define TUI_RUN_H
 
-int run(const char *username, char *password, char **argv);
+#include <sys/types.h>
+
+#include "cache.h"
+
+struct acct_t;
+struct pam_handle;
+
+/* seconds before the first restart, doubled for each one after it */
+#define RESTART_DELAY     1
+#define RESTART_MAX_DELAY 30
+
+/* a session that lasts this many seconds was not crashing on start */
+#define RESTART_STABLE    10
+
+/*
+ * What the login form has collected. verify only checks the password, for a
+ * user who has a session already; vt is the terminal the session has been
+ * given, if not the form's. With the credential cache, verifier is the
+ * user's cached one, if any, and cache asks for a new one after a full
+ * authentication. hooks are run before the session, for deadline seconds
+ * at most. groups, when the worker has found them looked up already, are
+ * the user's supplementary groups. A session that crashes on start is
+ * started again up to restarts times in a row, and then fallback, if any,
+ * is run instead.
+ */
+struct login_t {
+        char *username, *password;
+        char **argv, **limits, **hooks;
+        int deadline;
+
+        gid_t *groups;
+        int ngroups;
+
+        char **fallback;
+        int restarts;
+
+        int verify, vt;
+
+        int cache;
+        char verifier[CACHE_VERIFIER_SIZE];
+};
+
+/*
+ * What the worker reports over its pipe, in a single write: 0 once the
+ * session is starting or the error status, and a fresh verifier if asked.
+ */
+struct notice_t {
+        int status;
+        char verifier[CACHE_VERIFIER_SIZE];
+};
+
+void run_set_pam_confdir(const char *dir);
+
+struct pam_handle *prepare_pam();
+void discard_pam(struct pam_handle *pamh);
+
+int run(struct pam_handle *pamh, struct acct_t *acct,
+        struct login_t *login, int fd);
+
+const char *run_diag(int status);
+void run_ending(int code, char *buf, size_t size);
 
 #endif /* TUI_RUN_H */
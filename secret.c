@@ -0,0 +1,87 @@
+/* -*- mode: c; -*- */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "secret.h"
+
+/*
+ * Passwords live in fixed slots of a small arena of their own: locked in
+ * memory, left out of core dumps and wiped as soon as they are released.
+ * A password is copied once, from the form into its slot, and everything
+ * else refers to that copy. There is a slot per terminal that can be
+ * logging in at the same time.
+ */
+#define SECRET_SLOTS 64
+
+static char *arena;
+static unsigned char used[SECRET_SLOTS];
+
+static const size_t arena_size = SECRET_SLOTS * SECRET_SIZE;
+
+int secret_setup()
+{
+        void *p;
+
+        p = mmap(0, arena_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == p) {
+                fprintf(stderr, "secret arena : %s\n", strerror(errno));
+                return 1;
+        }
+
+        if (madvise(p, arena_size, MADV_DONTDUMP)) {
+                fprintf(stderr, "secret arena : %s\n", strerror(errno));
+                munmap(p, arena_size);
+                return 1;
+        }
+
+        arena = p;
+
+        if (secret_lock())
+                fprintf(stderr, "secret arena : %s\n", strerror(errno));
+
+        return 0;
+}
+
+/*
+ * Locks the arena in memory. A forked child has to do it again, locks are
+ * not inherited; without the privilege or the rlimit for it, passwords may
+ * be swapped out but are still wiped.
+ */
+int secret_lock()
+{
+        return arena && mlock(arena, arena_size);
+}
+
+char *secret_alloc()
+{
+        int i;
+
+        for (i = 0; arena && i < SECRET_SLOTS; ++i) {
+                if (!used[i]) {
+                        used[i] = 1;
+                        return arena + i * SECRET_SIZE;
+                }
+        }
+
+        fprintf(stderr, "secret arena : no free slot\n");
+
+        return 0;
+}
+
+void secret_free(char *secret)
+{
+        size_t i;
+
+        if (0 == secret)
+                return;
+
+        i = (secret - arena) / SECRET_SIZE;
+
+        explicit_bzero(secret, SECRET_SIZE);
+        used[i] = 0;
+}
@@ -0,0 +1,15 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_SECRET_H
+#define TUI_SECRET_H
+
+/* room for one password, the form's fields are shorter */
+#define SECRET_SIZE 256
+
+int secret_setup();
+int secret_lock();
+
+char *secret_alloc();
+void secret_free(char *secret);
+
+#endif /* TUI_SECRET_H */
@@ -0,0 +1,1026 @@
+/* -*- mode: c; -*- */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "startup.h"
+#include "utils.h"
+
+#define STARTUP_MAGIC   0x73746c67U
+#define STARTUP_VERSION 1
+
+/*
+ * Layout of the table: a header, the entries, the hash buckets (entry index
+ * plus one, zero for empty), the argv and key/value offset arrays and the
+ * strings. All offsets are from the start of the block.
+ */
+struct header_t {
+        uint32_t magic, version;
+        uint64_t key;
+
+        uint32_t size, nentries, nbuckets;
+        uint32_t entries, buckets;
+};
+
+struct entry_t {
+        uint32_t label, hash;
+        uint32_t argc, argv;
+        uint32_t nkv, kv;
+};
+
+struct startups_t {
+        char *base;
+        size_t size;
+        int mapped;
+};
+
+static const char *known_keys[] = {
+        "exec",
+        "cpu.weight",
+        "memory.high",
+        "hook",
+        "hook-deadline",
+        "prefetch",
+        "prefetch-limit",
+        "restart",
+        "fallback",
+        0
+};
+
+static const char *fallback = "[shell]\nexec = /bin/bash\n";
+
+/**********************************************************************/
+
+static uint32_t
+hash32(const char *s)
+{
+        uint32_t h = 2166136261U;
+
+        for (; *s; ++s)
+                h = (h ^ (unsigned char)*s) * 16777619U;
+
+        return h;
+}
+
+static void
+hash64(uint64_t *h, const void *data, size_t n)
+{
+        const unsigned char *p = data;
+
+        for (; n; --n, ++p)
+                *h = (*h ^ *p) * 1099511628211ULL;
+}
+
+static const struct header_t *
+header(const struct startups_t *s)
+{
+        return (const struct header_t *)s->base;
+}
+
+static const struct entry_t *
+entry(const struct startups_t *s, size_t i)
+{
+        return (const struct entry_t *)(s->base + header(s)->entries) + i;
+}
+
+static const uint32_t *
+u32s(const struct startups_t *s, uint32_t off)
+{
+        return (const uint32_t *)(s->base + off);
+}
+
+/**********************************************************************/
+
+struct vec_t {
+        char *p;
+        size_t len, cap;
+};
+
+static long
+vec_add(struct vec_t *v, const void *data, size_t n)
+{
+        size_t off = v->len;
+        char *p;
+
+        if (v->len + n > v->cap) {
+                v->cap = v->cap ? v->cap : 256;
+                while (v->len + n > v->cap)
+                        v->cap *= 2;
+
+                p = realloc(v->p, v->cap);
+                if (0 == p)
+                        return -1;
+
+                v->p = p;
+        }
+
+        memcpy(v->p + v->len, data, n);
+        v->len += n;
+
+        return off;
+}
+
+static long
+vec_add_u32(struct vec_t *v, uint32_t x)
+{
+        long off = vec_add(v, &x, sizeof x);
+        return 0 > off ? off : off / (long)sizeof x;
+}
+
+/*
+ * Entries are built one at a time; while being built, the offsets of an
+ * entry are relative to the vectors they point into.
+ */
+struct builder_t {
+        struct vec_t entries, argvs, kvs, strs;
+        long cur;
+        int bad;
+};
+
+static long
+add_string(struct builder_t *b, const char *s)
+{
+        return vec_add(&b->strs, s, strlen(s) + 1);
+}
+
+static struct entry_t *
+current(struct builder_t *b)
+{
+        return 0 > b->cur ? 0 : (struct entry_t *)b->entries.p + b->cur;
+}
+
+static void
+end_entry(struct builder_t *b, const char *where)
+{
+        struct entry_t *pe = current(b);
+
+        if (pe && !b->bad && 0 == pe->argc) {
+                fprintf(stderr, "%s: [%s] has no exec\n",
+                        where, b->strs.p + pe->label);
+                b->bad = 1;
+        }
+
+        /* dropped entries stay in the vectors but are never looked up */
+        if (pe && b->bad)
+                pe->label = UINT32_MAX;
+
+        b->cur = -1;
+        b->bad = 0;
+}
+
+/*
+ * Starts an entry, replacing an earlier one with the same label or, if not
+ * replace, leaving it alone and returning -1.
+ */
+static int
+begin_entry(struct builder_t *b, const char *label, int replace)
+{
+        struct entry_t e, *pe;
+        size_t i, n;
+        long off;
+
+        n = b->entries.len / sizeof e;
+        for (i = 0; i < n; ++i) {
+                pe = (struct entry_t *)b->entries.p + i;
+                if (UINT32_MAX != pe->label &&
+                    0 == strcmp(b->strs.p + pe->label, label)) {
+                        if (!replace)
+                                return -1;
+
+                        pe->label = UINT32_MAX;
+                }
+        }
+
+        memset(&e, 0, sizeof e);
+
+        if (0 > (off = add_string(b, label)))
+                return 1;
+
+        e.label = off;
+        e.hash = hash32(label);
+        e.argv = b->argvs.len / sizeof(uint32_t);
+        e.kv = b->kvs.len / sizeof(uint32_t);
+
+        if (0 > (off = vec_add(&b->entries, &e, sizeof e)))
+                return 1;
+
+        b->cur = off / sizeof e;
+        b->bad = 0;
+
+        return 0;
+}
+
+/*
+ * Splits a command line on blanks, honouring single and double quotes and
+ * backslash escapes, and appends the words to the current entry's argv.
+ */
+static int
+add_argv(struct builder_t *b, const char *s)
+{
+        struct entry_t *pe;
+        char *buf, *p;
+        int quote;
+        long off;
+
+        if (0 == (buf = malloc(strlen(s) + 1)))
+                return 1;
+
+        for (;;) {
+                while (' ' == *s || '\t' == *s)
+                        ++s;
+
+                if (0 == *s)
+                        break;
+
+                for (p = buf, quote = 0; *s; ++s) {
+                        if (quote) {
+                                if (quote == *s)
+                                        quote = 0;
+                                else if ('\\' == *s && '"' == quote && s[1])
+                                        *p++ = *++s;
+                                else
+                                        *p++ = *s;
+                        }
+                        else if ('"' == *s || '\'' == *s)
+                                quote = *s;
+                        else if ('\\' == *s && s[1])
+                                *p++ = *++s;
+                        else if (' ' == *s || '\t' == *s)
+                                break;
+                        else
+                                *p++ = *s;
+                }
+
+                if (quote) {
+                        free(buf);
+                        return -1;
+                }
+
+                *p = 0;
+
+                /* field codes of desktop entries, meaningless here */
+                if ('%' == buf[0] && buf[1] && 0 == buf[2]) {
+                        if ('%' != buf[1])
+                                continue;
+
+                        buf[1] = 0;
+                }
+
+                if (0 > (off = add_string(b, buf)) ||
+                    0 > vec_add_u32(&b->argvs, off)) {
+                        free(buf);
+                        return 1;
+                }
+
+                pe = current(b);
+                ++pe->argc;
+        }
+
+        free(buf);
+
+        return 0;
+}
+
+static int
+add_kv(struct builder_t *b, const char *key, const char *value,
+       const char *where)
+{
+        struct entry_t *pe = current(b);
+        const char **pp;
+        long k, v;
+        int ret;
+
+        for (pp = known_keys; *pp && strcmp(*pp, key); ++pp) ;
+        if (0 == *pp) {
+                fprintf(stderr, "%s: unknown key %s\n", where, key);
+                b->bad = 1;
+                return 0;
+        }
+
+        if (0 == strcmp(key, "exec")) {
+                if (pe->argc) {
+                        fprintf(stderr, "%s: duplicate exec\n", where);
+                        b->bad = 1;
+                        return 0;
+                }
+
+                if (0 > (ret = add_argv(b, value))) {
+                        fprintf(stderr, "%s: unterminated quote\n", where);
+                        b->bad = 1;
+                        return 0;
+                }
+
+                if (ret)
+                        return 1;
+        }
+
+        if (0 > (k = add_string(b, key)) || 0 > (v = add_string(b, value)) ||
+            0 > vec_add_u32(&b->kvs, k) || 0 > vec_add_u32(&b->kvs, v))
+                return 1;
+
+        ++current(b)->nkv;
+
+        return 0;
+}
+
+static char *
+trim(char *s)
+{
+        char *p;
+
+        while (' ' == *s || '\t' == *s)
+                ++s;
+
+        for (p = s + strlen(s); p != s && strchr(" \t\r\n", p[-1]); --p) ;
+        *p = 0;
+
+        return s;
+}
+
+static int
+parse_stream(struct builder_t *b, FILE *fp, const char *name)
+{
+        char *line = 0, *s, *p, where[512];
+        size_t len = 0;
+        int lineno = 0, ret = 0;
+
+        while (0 == ret && -1 != getline(&line, &len, fp)) {
+                snprintf(where, sizeof where, "%s:%d", name, ++lineno);
+
+                s = trim(line);
+                if (0 == *s || '#' == *s)
+                        continue;
+
+                if ('[' == *s) {
+                        end_entry(b, where);
+
+                        p = s + strlen(s) - 1;
+                        if (']' != *p || p == s + 1) {
+                                fprintf(stderr, "%s: bad section\n", where);
+                                continue;
+                        }
+
+                        *p = 0;
+                        ret = begin_entry(b, trim(s + 1), 1);
+                        continue;
+                }
+
+                if (0 == (p = strchr(s, '='))) {
+                        fprintf(stderr, "%s: expected key = value\n", where);
+                        b->bad = 1;
+                        continue;
+                }
+
+                if (0 > b->cur) {
+                        fprintf(stderr, "%s: key outside of a section\n",
+                                where);
+                        continue;
+                }
+
+                *p++ = 0;
+                ret = add_kv(b, trim(s), trim(p), where);
+        }
+
+        snprintf(where, sizeof where, "%s", name);
+        end_entry(b, where);
+
+        free(line);
+
+        return ret;
+}
+
+static int
+parse_file(struct builder_t *b, const char *path)
+{
+        FILE *fp;
+        int ret;
+
+        if (0 == (fp = fopen(path, "r"))) {
+                if (ENOENT != errno)
+                        fprintf(stderr, "%s : %s\n", path, strerror(errno));
+                return 0;
+        }
+
+        ret = parse_stream(b, fp, path);
+        fclose(fp);
+
+        return ret;
+}
+
+static int
+find_exec(const char *name)
+{
+        const char *path, *p, *q;
+        char *s;
+        int ret;
+
+        if (strchr(name, '/'))
+                return access(name, X_OK);
+
+        path = getenv("PATH");
+        if (0 == path || 0 == path[0])
+                path = "/usr/local/sbin:/usr/local/bin:/usr/bin:/bin";
+
+        for (p = path; *p; p = *q ? q + 1 : q) {
+                q = strchrnul(p, ':');
+
+                if (0 == (s = snprintf_(0, 0, "%.*s/%s", (int)(q - p), p, name)))
+                        return -1;
+
+                ret = access(s, X_OK);
+                free(s);
+
+                if (0 == ret)
+                        return 0;
+        }
+
+        return -1;
+}
+
+/*
+ * Adds the session described by a desktop entry, unless an entry with that
+ * name is configured already, the entry is hidden or its TryExec program
+ * is not installed.
+ */
+static int
+parse_desktop(struct builder_t *b, const char *path)
+{
+        char *line = 0, *s, *p, *name = 0, *exec = 0, *tryexec = 0;
+        size_t len = 0;
+        int main_group = 0, hidden = 0, ret = 0;
+        FILE *fp;
+
+        if (0 == (fp = fopen(path, "r")))
+                return 0;
+
+        while (-1 != getline(&line, &len, fp)) {
+                s = trim(line);
+
+                if ('[' == *s) {
+                        main_group = 0 == strcmp(s, "[Desktop Entry]");
+                        continue;
+                }
+
+                if (!main_group || 0 == (p = strchr(s, '=')))
+                        continue;
+
+                *p++ = 0;
+                s = trim(s);
+                p = trim(p);
+
+                if (0 == strcmp(s, "Name") && 0 == name)
+                        name = strdup(p);
+                else if (0 == strcmp(s, "Exec") && 0 == exec)
+                        exec = strdup(p);
+                else if (0 == strcmp(s, "TryExec") && 0 == tryexec)
+                        tryexec = strdup(p);
+                else if ((0 == strcmp(s, "Hidden") ||
+                          0 == strcmp(s, "NoDisplay")) &&
+                         0 == strcmp(p, "true"))
+                        hidden = 1;
+        }
+
+        fclose(fp);
+        free(line);
+
+        if (name && name[0] && exec && exec[0] && !hidden &&
+            (0 == tryexec || 0 == find_exec(tryexec))) {
+                if (0 == (ret = begin_entry(b, name, 0))) {
+                        ret = add_kv(b, "exec", exec, path);
+                        end_entry(b, path);
+                }
+
+                ret = 0 < ret;
+        }
+
+        free(name);
+        free(exec);
+        free(tryexec);
+
+        return ret;
+}
+
+/*
+ * Lays the entries out in their final form: header, entries, buckets,
+ * argvs, key/value pairs and strings.
+ */
+static struct startups_t *
+assemble(struct builder_t *b, uint64_t key)
+{
+        struct startups_t *s;
+        struct header_t *h;
+        struct entry_t *pe, *src;
+        uint32_t *buckets, *pu, base_argvs, base_kvs, base_strs, j;
+        size_t i, n, nall, nb, size;
+
+        nall = b->entries.len / sizeof *src;
+
+        for (i = n = 0; i < nall; ++i)
+                if (UINT32_MAX != ((struct entry_t *)b->entries.p)[i].label)
+                        ++n;
+
+        for (nb = 8; nb < 2 * n; nb *= 2) ;
+
+        size  = sizeof *h + n * sizeof *pe + nb * sizeof *buckets;
+        base_argvs = size;
+        size += b->argvs.len;
+        base_kvs = size;
+        size += b->kvs.len;
+        base_strs = size;
+        size += b->strs.len + 1;
+
+        if (UINT32_MAX <= size)
+                return 0;
+
+        if (0 == (s = calloc(1, sizeof *s)))
+                return 0;
+
+        if (0 == (s->base = calloc(1, size))) {
+                free(s);
+                return 0;
+        }
+
+        s->size = size;
+
+        h = (struct header_t *)s->base;
+        h->magic = STARTUP_MAGIC;
+        h->version = STARTUP_VERSION;
+        h->key = key;
+        h->size = size;
+        h->nentries = n;
+        h->nbuckets = nb;
+        h->entries = sizeof *h;
+        h->buckets = h->entries + n * sizeof *pe;
+
+        pe = (struct entry_t *)(s->base + h->entries);
+        buckets = (uint32_t *)(s->base + h->buckets);
+
+        for (i = n = 0; i < nall; ++i) {
+                src = (struct entry_t *)b->entries.p + i;
+                if (UINT32_MAX == src->label)
+                        continue;
+
+                pe[n] = *src;
+                pe[n].label += base_strs;
+                pe[n].argv = base_argvs + src->argv * sizeof(uint32_t);
+                pe[n].kv = base_kvs + src->kv * sizeof(uint32_t);
+
+                for (j = pe[n].hash & (nb - 1); buckets[j]; j = (j + 1) & (nb - 1)) ;
+                buckets[j] = ++n;
+        }
+
+        memcpy(s->base + base_argvs, b->argvs.p, b->argvs.len);
+        memcpy(s->base + base_kvs, b->kvs.p, b->kvs.len);
+        memcpy(s->base + base_strs, b->strs.p, b->strs.len);
+
+        pu = (uint32_t *)(s->base + base_argvs);
+        for (i = 0; i < (b->argvs.len + b->kvs.len) / sizeof *pu; ++i)
+                pu[i] += base_strs;
+
+        return s;
+}
+
+/**********************************************************************/
+
+static int
+is_conf(const struct dirent *d)
+{
+        size_t n = strlen(d->d_name);
+        return '.' != d->d_name[0] && n > 5 &&
+                0 == strcmp(d->d_name + n - 5, ".conf");
+}
+
+/*
+ * The drop-in directory of foo.conf is foo.d, its files are read in
+ * lexical order after foo.conf itself.
+ */
+static char *
+dropin_dir(const char *conf)
+{
+        size_t n = strlen(conf);
+
+        if (n > 5 && 0 == strcmp(conf + n - 5, ".conf"))
+                n -= 5;
+
+        return snprintf_(0, 0, "%.*s.d", (int)n, conf);
+}
+
+static void
+hash_stat(uint64_t *key, const char *path)
+{
+        struct stat st;
+
+        hash64(key, path, strlen(path) + 1);
+
+        if (stat(path, &st))
+                memset(&st, 0, sizeof st);
+
+        hash64(key, &st.st_ino, sizeof st.st_ino);
+        hash64(key, &st.st_size, sizeof st.st_size);
+        hash64(key, &st.st_mtim, sizeof st.st_mtim);
+}
+
+static int
+is_desktop(const struct dirent *d)
+{
+        size_t n = strlen(d->d_name);
+        return '.' != d->d_name[0] && n > 8 &&
+                0 == strcmp(d->d_name + n - 8, ".desktop");
+}
+
+/*
+ * Installed sessions are found through their desktop entries. Only the
+ * modification times of the directories go into the cache key, so the cost
+ * of checking the cache does not grow with the number of sessions.
+ */
+static const char *session_dirs[] = {
+        "/usr/share/wayland-sessions",
+        "/usr/share/xsessions",
+        0
+};
+
+struct sources_t {
+        char *conf, *dir;
+        struct dirent **files;
+        int nfiles;
+};
+
+static char *
+source_path(const struct sources_t *src, int i)
+{
+        return snprintf_(0, 0, "%s/%s", src->dir, src->files[i]->d_name);
+}
+
+static uint64_t
+sources_key(struct sources_t *src)
+{
+        uint64_t key = 14695981039346656037ULL;
+        const char **pp;
+        char *path;
+        int i;
+
+        hash_stat(&key, src->conf);
+        hash_stat(&key, src->dir);
+
+        for (pp = session_dirs; *pp; ++pp)
+                hash_stat(&key, *pp);
+
+        for (i = 0; i < src->nfiles; ++i) {
+                if ((path = source_path(src, i))) {
+                        hash_stat(&key, path);
+                        free(path);
+                }
+        }
+
+        return key;
+}
+
+static int
+open_sources(struct sources_t *src, const char *conf)
+{
+        memset(src, 0, sizeof *src);
+
+        if (0 == (src->conf = strdup(conf)) ||
+            0 == (src->dir = dropin_dir(conf)))
+                return 1;
+
+        src->nfiles = scandir(src->dir, &src->files, is_conf, alphasort);
+        if (0 > src->nfiles)
+                src->nfiles = 0;
+
+        return 0;
+}
+
+static void
+close_sources(struct sources_t *src)
+{
+        int i;
+
+        for (i = 0; i < src->nfiles; ++i)
+                free(src->files[i]);
+
+        free(src->files);
+        free(src->conf);
+        free(src->dir);
+}
+
+static int
+parse_dir(struct builder_t *b, const char *dir)
+{
+        struct dirent **files;
+        char *path;
+        int i, n, ret = 0;
+
+        if (0 > (n = scandir(dir, &files, is_desktop, alphasort)))
+                return 0;
+
+        for (i = 0; i < n; ++i) {
+                path = snprintf_(0, 0, "%s/%s", dir, files[i]->d_name);
+                if (0 == ret)
+                        ret = path ? parse_desktop(b, path) : 1;
+
+                free(path);
+                free(files[i]);
+        }
+
+        free(files);
+
+        return ret;
+}
+
+static struct startups_t *
+parse_sources(struct sources_t *src, uint64_t key)
+{
+        struct builder_t b;
+        struct startups_t *s = 0;
+        const char **pp;
+        char *path;
+        FILE *fp;
+        int i, ret;
+
+        memset(&b, 0, sizeof b);
+        b.cur = -1;
+
+        ret = parse_file(&b, src->conf);
+
+        for (i = 0; 0 == ret && i < src->nfiles; ++i) {
+                if (0 == (path = source_path(src, i)))
+                        ret = 1;
+                else {
+                        ret = parse_file(&b, path);
+                        free(path);
+                }
+        }
+
+        for (pp = session_dirs; 0 == ret && *pp; ++pp)
+                ret = parse_dir(&b, *pp);
+
+        if (0 == ret && 0 == b.entries.len) {
+                fp = fmemopen((void *)fallback, strlen(fallback), "r");
+                if (fp) {
+                        ret = parse_stream(&b, fp, "built-in");
+                        fclose(fp);
+                }
+        }
+
+        if (0 == ret)
+                s = assemble(&b, key);
+
+        free(b.entries.p);
+        free(b.argvs.p);
+        free(b.kvs.p);
+        free(b.strs.p);
+
+        return s;
+}
+
+/**********************************************************************/
+
+/*
+ * A cached table is used only if it is internally consistent, so that a
+ * truncated or corrupted cache is rebuilt rather than trusted.
+ */
+static int
+check_table(const struct startups_t *s, uint64_t key)
+{
+        const struct header_t *h = header(s);
+        const struct entry_t *pe;
+        const uint32_t *pu;
+        size_t i, j;
+
+        if (s->size < sizeof *h || STARTUP_MAGIC != h->magic ||
+            STARTUP_VERSION != h->version || key != h->key ||
+            s->size != h->size || 0 != s->base[s->size - 1])
+                return 1;
+
+        if (h->entries % 4 || h->buckets % 4 ||
+            h->entries + (size_t)h->nentries * sizeof *pe > s->size ||
+            h->buckets + (size_t)h->nbuckets * 4 > s->size ||
+            0 == h->nbuckets || h->nbuckets & (h->nbuckets - 1))
+                return 1;
+
+        pu = u32s(s, h->buckets);
+        for (i = 0; i < h->nbuckets; ++i)
+                if (pu[i] > h->nentries)
+                        return 1;
+
+        for (i = 0; i < h->nentries; ++i) {
+                pe = entry(s, i);
+
+                if (pe->label >= s->size || 0 == pe->argc ||
+                    pe->argv % 4 || pe->kv % 4 ||
+                    pe->argv + (size_t)pe->argc * 4 > s->size ||
+                    pe->kv + (size_t)pe->nkv * 8 > s->size)
+                        return 1;
+
+                for (pu = u32s(s, pe->argv), j = 0; j < pe->argc; ++j)
+                        if (pu[j] >= s->size)
+                                return 1;
+
+                for (pu = u32s(s, pe->kv), j = 0; j < 2 * pe->nkv; ++j)
+                        if (pu[j] >= s->size)
+                                return 1;
+        }
+
+        return 0;
+}
+
+static struct startups_t *
+map_cache(const char *cache, uint64_t key)
+{
+        struct startups_t *s;
+        struct stat st;
+        void *p;
+        int fd;
+
+        if (0 > (fd = open(cache, O_RDONLY | O_CLOEXEC)))
+                return 0;
+
+        if (fstat(fd, &st) || (size_t)st.st_size < sizeof(struct header_t)) {
+                close(fd);
+                return 0;
+        }
+
+        p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (MAP_FAILED == p)
+                return 0;
+
+        if (0 == (s = calloc(1, sizeof *s))) {
+                munmap(p, st.st_size);
+                return 0;
+        }
+
+        s->base = p;
+        s->size = st.st_size;
+        s->mapped = 1;
+
+        if (check_table(s, key)) {
+                free_startups(s);
+                return 0;
+        }
+
+        return s;
+}
+
+static void
+write_cache(const struct startups_t *s, const char *cache)
+{
+        char *tmp;
+        int fd, ok;
+
+        if (0 == cache || 0 == (tmp = snprintf_(0, 0, "%s.%d", cache, getpid())))
+                return;
+
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (0 <= fd) {
+                ok = (ssize_t)s->size == write(fd, s->base, s->size);
+                ok = 0 == close(fd) && ok;
+
+                if (!ok || rename(tmp, cache))
+                        unlink(tmp);
+        }
+
+        free(tmp);
+}
+
+struct startups_t *load_startups(const char *conf, const char *cache)
+{
+        struct sources_t src;
+        struct startups_t *s = 0;
+        uint64_t key;
+
+        if (open_sources(&src, conf))
+                goto out;
+
+        key = sources_key(&src);
+
+        if (cache && (s = map_cache(cache, key)))
+                goto out;
+
+        if ((s = parse_sources(&src, key)))
+                write_cache(s, cache);
+
+out:
+        close_sources(&src);
+
+        if (0 == s)
+                fprintf(stderr, "failed to load %s\n", conf);
+
+        return s;
+}
+
+void free_startups(struct startups_t *s)
+{
+        if (s) {
+                if (s->mapped)
+                        munmap(s->base, s->size);
+                else
+                        free(s->base);
+
+                free(s);
+        }
+}
+
+size_t startups_count(const struct startups_t *s)
+{
+        return header(s)->nentries;
+}
+
+int startup_find(const struct startups_t *s, const char *label)
+{
+        const struct header_t *h = header(s);
+        const uint32_t *buckets = u32s(s, h->buckets);
+        const struct entry_t *pe;
+        uint32_t hash, i, n;
+
+        hash = hash32(label);
+
+        for (i = hash & (h->nbuckets - 1), n = 0;
+             buckets[i] && n < h->nbuckets;
+             i = (i + 1) & (h->nbuckets - 1), ++n) {
+                pe = entry(s, buckets[i] - 1);
+
+                if (hash == pe->hash && 0 == strcmp(s->base + pe->label, label))
+                        return buckets[i] - 1;
+        }
+
+        return -1;
+}
+
+const char *startup_label(const struct startups_t *s, size_t i)
+{
+        return s->base + entry(s, i)->label;
+}
+
+/*
+ * Returns a null-terminated argv pointing into the table; the caller frees
+ * the array, not the strings.
+ */
+char **startup_argv(const struct startups_t *s, size_t i)
+{
+        const struct entry_t *pe = entry(s, i);
+        const uint32_t *pu = u32s(s, pe->argv);
+        char **argv;
+        size_t j;
+
+        if (0 == (argv = malloc((pe->argc + 1) * sizeof *argv)))
+                return 0;
+
+        for (j = 0; j < pe->argc; ++j)
+                argv[j] = s->base + pu[j];
+
+        argv[j] = 0;
+
+        return argv;
+}
+
+/* the value of key in entry i, 0 if it has none */
+const char *startup_value(const struct startups_t *s, size_t i,
+                          const char *key)
+{
+        const struct entry_t *pe = entry(s, i);
+        const uint32_t *pu = u32s(s, pe->kv);
+        size_t j;
+
+        for (j = 0; j < pe->nkv; ++j) {
+                if (0 == strcmp(s->base + pu[2 * j], key))
+                        return s->base + pu[2 * j + 1];
+        }
+
+        return 0;
+}
+
+/*
+ * Returns the values of every key in entry i, in order, as a null-terminated
+ * array pointing into the table; the caller frees the array, not the strings.
+ */
+char **startup_values(const struct startups_t *s, size_t i, const char *key)
+{
+        const struct entry_t *pe = entry(s, i);
+        const uint32_t *pu = u32s(s, pe->kv);
+        char **values;
+        size_t j, n = 0;
+
+        if (0 == (values = malloc((pe->nkv + 1) * sizeof *values)))
+                return 0;
+
+        for (j = 0; j < pe->nkv; ++j) {
+                if (0 == strcmp(s->base + pu[2 * j], key))
+                        values[n++] = s->base + pu[2 * j + 1];
+        }
+
+        values[n] = 0;
+
+        return values;
+}
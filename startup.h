@@ -0,0 +1,35 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_STARTUP_H
+#define TUI_STARTUP_H
+
+#include <stddef.h>
+
+/*
+ * The table of things logitty can start, read from a configuration file
+ * and its drop-in directory, followed by the sessions installed in
+ * /usr/share/{wayland-sessions,xsessions}:
+ *
+ *   [dwl]
+ *   exec = /usr/local/bin/run-dwl.sh -s "dwl startup.sh"
+ *   memory.high = 4G
+ *
+ * The table lives in a single block of memory that only holds offsets, so
+ * that it can be cached on disk and mapped back as is.
+ */
+struct startups_t;
+
+struct startups_t *load_startups(const char *conf, const char *cache);
+void free_startups(struct startups_t *startups);
+
+size_t startups_count(const struct startups_t *startups);
+
+int startup_find(const struct startups_t *startups, const char *label);
+const char *startup_label(const struct startups_t *startups, size_t i);
+char **startup_argv(const struct startups_t *startups, size_t i);
+const char *startup_value(const struct startups_t *startups, size_t i,
+                          const char *key);
+char **startup_values(const struct startups_t *startups, size_t i,
+                      const char *key);
+
+#endif /* TUI_STARTUP_H */
@@ -0,0 +1,211 @@
+/* -*- mode: c; -*- */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "throttle.h"
+
+/*
+ * The buckets live in a fixed hash table, open addressing with a short
+ * probe: a user or a terminal nobody has tried in a while takes no room,
+ * and when the table is full the least recently used of the probed slots
+ * goes, never the other bucket of the same attempt. Memory and the time
+ * per attempt are both bounded, whatever is thrown at the form.
+ */
+#define TABLE_SIZE 256
+#define PROBES     8
+
+/* attempts in a burst, and the time it takes to earn one back */
+#define USER_BURST  5
+#define USER_REFILL 30000
+#define TTY_BURST   10
+#define TTY_REFILL  6000
+
+/* failures in a row after which attempts are pushed back, and how far */
+#define BACKOFF_AFTER 3
+#define BACKOFF_BASE  1000
+#define BACKOFF_MAX   60000
+
+struct bucket_t {
+        char key[40];
+
+        /* last is when tokens were last earned, used when last looked up */
+        long long last, used;
+        long long due;
+
+        int tokens, failures;
+};
+
+static struct bucket_t table[TABLE_SIZE];
+
+struct throttle_stats_t throttle_stats;
+
+static long long
+now_ms()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static unsigned
+hash(const char *s)
+{
+        unsigned h = 2166136261u;
+
+        for (; *s; ++s)
+                h = (h ^ (unsigned char)*s) * 16777619u;
+
+        return h;
+}
+
+/* earns back the tokens due since the bucket was last looked at */
+static void
+refill(struct bucket_t *b, int burst, long period, long long now)
+{
+        long long n = (now - b->last) / period;
+
+        if (b->tokens + n >= burst) {
+                b->tokens = burst;
+                b->last = now;
+        }
+        else {
+                b->tokens += n;
+                b->last += n * period;
+        }
+}
+
+/* a bucket that holds nothing a fresh one would not */
+static int
+idle(struct bucket_t *b, int burst, long period, long long now)
+{
+        return 0 == b->key[0] ||
+                (0 == b->failures && b->due <= now &&
+                 b->tokens + (now - b->last) / period >= burst);
+}
+
+/* the bucket of name, in a slot other than taken */
+static struct bucket_t *
+lookup(char kind, const char *name, int burst, long period, long long now,
+       const struct bucket_t *taken)
+{
+        struct bucket_t *b, *victim = 0;
+        char key[sizeof b->key];
+        unsigned h;
+        int i;
+
+        snprintf(key, sizeof key, "%c:%s", kind, name);
+        h = hash(key);
+
+        for (i = 0; i < PROBES; ++i) {
+                b = table + (h + i) % TABLE_SIZE;
+
+                if (0 == strcmp(b->key, key)) {
+                        b->used = now;
+                        return b;
+                }
+
+                if (b == taken)
+                        continue;
+
+                if (0 == victim || idle(b, burst, period, now) ||
+                    (!idle(victim, burst, period, now) && b->used < victim->used))
+                        victim = b;
+        }
+
+        memset(victim, 0, sizeof *victim);
+        strcpy(victim->key, key);
+        victim->tokens = burst;
+        victim->last = victim->used = now;
+
+        return victim;
+}
+
+/* both buckets of an attempt, looked up before either is used */
+static void
+buckets(const char *username, const char *tty, long long now,
+        struct bucket_t **u, struct bucket_t **t)
+{
+        *u = lookup('u', username, USER_BURST, USER_REFILL, now, 0);
+        *t = lookup('t', tty, TTY_BURST, TTY_REFILL, now, *u);
+}
+
+/*
+ * Takes a token for an attempt by username on tty. Returns 0 if the
+ * attempt can go ahead, with delay set to how long it has to be held back
+ * for first, or 1 if it is rejected, with delay set to when to try again.
+ */
+int throttle_check(const char *username, const char *tty, long *delay)
+{
+        long long now = now_ms();
+        struct bucket_t *u, *t;
+
+        buckets(username, tty, now, &u, &t);
+
+        refill(u, USER_BURST, USER_REFILL, now);
+        refill(t, TTY_BURST, TTY_REFILL, now);
+
+        if (0 == u->tokens || 0 == t->tokens) {
+                *delay = 0 == u->tokens ?
+                        u->last + USER_REFILL - now :
+                        t->last + TTY_REFILL - now;
+
+                ++throttle_stats.rejected;
+                fprintf(stderr, "throttle : rejected %s on %s\n",
+                        username, tty);
+
+                return 1;
+        }
+
+        --u->tokens;
+        --t->tokens;
+
+        *delay = u->due > t->due ? u->due - now : t->due - now;
+
+        if (0 < *delay) {
+                ++throttle_stats.delayed;
+                fprintf(stderr, "throttle : delayed %s on %s by %ldms\n",
+                        username, tty, *delay);
+        }
+        else
+                *delay = 0;
+
+        return 0;
+}
+
+static void
+backoff(struct bucket_t *b, long long now)
+{
+        long delay;
+        int n;
+
+        if (++b->failures < BACKOFF_AFTER)
+                return;
+
+        n = b->failures - BACKOFF_AFTER;
+        delay = n < 16 ? BACKOFF_BASE << n : BACKOFF_MAX;
+        if (delay > BACKOFF_MAX)
+                delay = BACKOFF_MAX;
+
+        b->due = now + delay;
+}
+
+void throttle_result(const char *username, const char *tty, int ok)
+{
+        long long now = now_ms();
+        struct bucket_t *u, *t;
+
+        buckets(username, tty, now, &u, &t);
+
+        /* anyone with one account must not wipe the terminal's limit */
+        if (ok) {
+                memset(u, 0, sizeof *u);
+                return;
+        }
+
+        backoff(u, now);
+        backoff(t, now);
+}
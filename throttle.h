@@ -0,0 +1,21 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_THROTTLE_H
+#define TUI_THROTTLE_H
+
+/*
+ * Login attempts are metered per user and per terminal: a token bucket
+ * caps their rate, and consecutive failures push the next attempt back
+ * exponentially. A successful login clears the user's record; the
+ * terminal's is left to refill at its own rate.
+ */
+struct throttle_stats_t {
+        unsigned long rejected, delayed;
+};
+
+extern struct throttle_stats_t throttle_stats;
+
+int throttle_check(const char *username, const char *tty, long *delay);
+void throttle_result(const char *username, const char *tty, int ok);
+
+#endif /* TUI_THROTTLE_H */
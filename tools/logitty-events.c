@@ -0,0 +1,180 @@
+/* -*- mode: c; -*- */
+
+/*
+ * Prints logitty's event log, oldest first, one event per line, as text or
+ * as JSON:
+ *
+ *   logitty-events [-j] events
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "events.h"
+
+/* in the order of trace.h */
+static const char *phase_names[TRACE_PHASES] = {
+        [TRACE_GETPWNAM]         = "getpwnam",
+        [TRACE_PAM_START]        = "pam_start",
+        [TRACE_CACHE_CHECK]      = "cache_check",
+        [TRACE_PAM_AUTHENTICATE] = "pam_authenticate",
+        [TRACE_PAM_ACCT_MGMT]    = "pam_acct_mgmt",
+        [TRACE_PAM_SETCRED]      = "pam_setcred",
+        [TRACE_PAM_OPEN_SESSION] = "pam_open_session",
+        [TRACE_CACHE_MAKE]       = "cache_make",
+        [TRACE_GETGROUPLIST]     = "getgrouplist",
+        [TRACE_SETUP_ENV]        = "setup_env",
+        [TRACE_FORK]             = "fork",
+        [TRACE_SETUID]           = "setuid",
+        [TRACE_ACCT_LOGIN]       = "acct_login",
+        [TRACE_EXEC]             = "exec",
+};
+
+static const char *
+type_name(int type)
+{
+        switch (type) {
+        case EVENT_LOGIN:
+                return "login";
+        case EVENT_FAILURE:
+                return "failure";
+        case EVENT_LOGOUT:
+                return "logout";
+        default:
+                return "unknown";
+        }
+}
+
+/* a string of the record, which need not be terminated */
+static void
+print_string(const char *s, size_t n, int json)
+{
+        size_t i;
+
+        if (json)
+                putchar('"');
+
+        for (i = 0; i < n && s[i]; ++i) {
+                if (json && ('"' == s[i] || '\\' == s[i]))
+                        printf("\\%c", s[i]);
+                else if ((unsigned char)s[i] < 0x20)
+                        printf(json ? "\\u%04x" : "\\x%02x", s[i]);
+                else
+                        putchar(s[i]);
+        }
+
+        if (!json && 0 == i)
+                putchar('-');
+
+        if (json)
+                putchar('"');
+}
+
+static void
+print_event(const struct event_t *ev, int json)
+{
+        char buf[64];
+        struct tm tm;
+        time_t t;
+        size_t i, n;
+
+        t = ev->time / 1000000000LL;
+        gmtime_r(&t, &tm);
+        n = strftime(buf, sizeof buf, "%Y-%m-%dT%H:%M:%S", &tm);
+        snprintf(buf + n, sizeof buf - n, ".%06lldZ",
+                 (long long)(ev->time % 1000000000LL) / 1000);
+
+        if (json) {
+                printf("{\"seq\":%llu,\"time\":\"%s\",\"type\":\"%s\","
+                       "\"tty\":", (unsigned long long)ev->seq, buf,
+                       type_name(ev->type));
+                print_string(ev->tty, sizeof ev->tty, 1);
+                printf(",\"user\":");
+                print_string(ev->user, sizeof ev->user, 1);
+                printf(",\"uid\":%d,\"pid\":%d,\"status\":%d,\"phases\":{",
+                       (int)ev->uid, ev->pid, ev->status);
+        }
+        else {
+                printf("%s %s ", buf, type_name(ev->type));
+                print_string(ev->tty, sizeof ev->tty, 0);
+                putchar(' ');
+                print_string(ev->user, sizeof ev->user, 0);
+                printf(" uid=%d pid=%d status=%d", (int)ev->uid, ev->pid,
+                       ev->status);
+        }
+
+        /* milliseconds, like the trace lines */
+        for (i = 0, n = 0; i < ev->nphases && i < TRACE_PHASES; ++i) {
+                if (0 == ev->phases[i])
+                        continue;
+
+                if (json)
+                        printf("%s\"%s\":%.3f", n++ ? "," : "",
+                               phase_names[i], ev->phases[i] / 1e3);
+                else
+                        printf(" %s=%.3f", phase_names[i],
+                               ev->phases[i] / 1e3);
+        }
+
+        printf(json ? "}}\n" : "\n");
+}
+
+int main(int argc, char **argv)
+{
+        struct events_header_t h;
+        struct event_t ev;
+        unsigned long long seq, first;
+        int c, fd, json = 0;
+
+        while (-1 != (c = getopt(argc, argv, "j"))) {
+                switch (c) {
+                case 'j':
+                        json = 1;
+                        break;
+
+                default:
+                        fprintf(stderr, "usage: logitty-events [-j] events\n");
+                        return 1;
+                }
+        }
+
+        if (optind + 1 != argc) {
+                fprintf(stderr, "usage: logitty-events [-j] events\n");
+                return 1;
+        }
+
+        if (0 > (fd = open(argv[optind], O_RDONLY))) {
+                fprintf(stderr, "%s : %s\n", argv[optind], strerror(errno));
+                return 1;
+        }
+
+        if (sizeof h != pread(fd, &h, sizeof h, 0) ||
+            memcmp(h.magic, EVENTS_MAGIC, sizeof h.magic) ||
+            sizeof ev != h.size || 0 == h.capacity) {
+                fprintf(stderr, "%s : not an event log\n", argv[optind]);
+                close(fd);
+                return 1;
+        }
+
+        first = h.next > h.capacity ? h.next - h.capacity : 0;
+
+        for (seq = first; seq < h.next; ++seq) {
+                if (sizeof ev != pread(fd, &ev, sizeof ev, EVENTS_HEADER_SIZE +
+                                       (off_t)(seq % h.capacity) * sizeof ev))
+                        break;
+
+                /* a slot taken but not written yet, or written over since */
+                if (ev.seq != seq || 0 == ev.type)
+                        continue;
+
+                print_event(&ev, json);
+        }
+
+        close(fd);
+
+        return 0;
+}
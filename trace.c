@@ -0,0 +1,111 @@
+/* -*- mode: c; -*- */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static const char *phase_names[] = {
+        "getpwnam",
+        "pam_start",
+        "cache_check",
+        "pam_authenticate",
+        "pam_acct_mgmt",
+        "pam_setcred",
+        "pam_open_session",
+        "cache_make",
+        "getgrouplist",
+        "setup_env",
+        "fork",
+        "setuid",
+        "acct_login",
+        "exec",
+};
+
+struct span_t {
+        long long start, stop;
+};
+
+static struct {
+        struct timespec begin;
+        struct span_t spans[TRACE_PHASES];
+        int active;
+} trace;
+
+static long long
+now()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (long long)(ts.tv_sec - trace.begin.tv_sec) * 1000000000LL +
+                (ts.tv_nsec - trace.begin.tv_nsec);
+}
+
+void trace_begin(void)
+{
+        memset(&trace, 0, sizeof trace);
+        clock_gettime(CLOCK_MONOTONIC, &trace.begin);
+        trace.active = 1;
+}
+
+void trace_start(enum trace_phase_t phase)
+{
+        if (trace.active)
+                trace.spans[phase].start = now();
+}
+
+void trace_stop(enum trace_phase_t phase)
+{
+        if (trace.active)
+                trace.spans[phase].stop = now();
+}
+
+/* each phase's duration in microseconds, 0 for those not run */
+void trace_durations(unsigned int *us)
+{
+        size_t i;
+
+        for (i = 0; i < TRACE_PHASES; ++i) {
+                const struct span_t *p = trace.spans + i;
+
+                us[i] = p->stop ? (p->stop - p->start) / 1000 : 0;
+        }
+}
+
+void trace_end(const char *username, int status)
+{
+        char buf[1024];
+        const char *tty;
+        size_t i, n;
+
+        if (0 == trace.active)
+                return;
+
+        tty = ttyname(STDIN_FILENO);
+        if (tty && 0 == strncmp(tty, "/dev/", 5))
+                tty += 5;
+
+        n = snprintf(buf, sizeof buf, "trace: user=%s tty=%s status=%d",
+                     username ? username : "-", tty ? tty : "-", status);
+
+        for (i = 0; i < TRACE_PHASES && n < sizeof buf; ++i) {
+                const struct span_t *p = trace.spans + i;
+
+                if (0 == p->stop)
+                        continue;
+
+                n += snprintf(buf + n, sizeof buf - n, " %s=%.3f+%.3f",
+                              phase_names[i], p->start / 1e6,
+                              (p->stop - p->start) / 1e6);
+        }
+
+        if (n < sizeof buf)
+                snprintf(buf + n, sizeof buf - n, " total=%.3f", now() / 1e6);
+
+        fprintf(stderr, "%s\n", buf);
+        trace.active = 0;
+}
@@ -0,0 +1,64 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_TRACE_H
+#define TUI_TRACE_H
+
+/*
+ * Login latency tracing. Each login attempt is timed from the moment Enter
+ * is pressed until the session is exec'd (or the attempt fails) and is
+ * reported as a single line on stderr:
+ *
+ *   trace: user=joe tty=tty2 status=0 getpwnam=0.012+0.101 ... total=8.901
+ *
+ * where each phase is reported as <start>+<duration>, in milliseconds
+ * relative to Enter. The session child is vfork'd and shares our memory up
+ * to the exec, so it records its phases in place. Building without
+ * LOGITTY_TRACE compiles all of it out.
+ */
+
+enum trace_phase_t {
+        TRACE_GETPWNAM,
+        TRACE_PAM_START,
+        TRACE_CACHE_CHECK,
+        TRACE_PAM_AUTHENTICATE,
+        TRACE_PAM_ACCT_MGMT,
+        TRACE_PAM_SETCRED,
+        TRACE_PAM_OPEN_SESSION,
+        TRACE_CACHE_MAKE,
+        TRACE_GETGROUPLIST,
+        TRACE_SETUP_ENV,
+        TRACE_FORK,
+        TRACE_SETUID,
+        TRACE_ACCT_LOGIN,
+        TRACE_EXEC,
+
+        TRACE_PHASES
+};
+
+#if defined(LOGITTY_TRACE)
+
+void trace_begin(void);
+void trace_end(const char *username, int status);
+
+void trace_start(enum trace_phase_t phase);
+void trace_stop(enum trace_phase_t phase);
+
+void trace_durations(unsigned int *us);
+
+#  define TRACE_BEGIN()            trace_begin()
+#  define TRACE_END(user, status)  trace_end(user, status)
+#  define TRACE_START(phase)       trace_start(phase)
+#  define TRACE_STOP(phase)        trace_stop(phase)
+#  define TRACE_DURATIONS(us)      trace_durations(us)
+
+#else
+
+#  define TRACE_BEGIN()            ((void)0)
+#  define TRACE_END(user, status)  ((void)0)
+#  define TRACE_START(phase)       ((void)0)
+#  define TRACE_STOP(phase)        ((void)0)
+#  define TRACE_DURATIONS(us)      ((void)0)
+
+#endif /* LOGITTY_TRACE */
+
+#endif /* TUI_TRACE_H */
@@ -17,17 +17,57 @@
 #include <ncurses.h>
 #include <form.h>
 
+#include "input.h"
+#include "secret.h"
+#include "metrics.h"
 #include "ui.h"
 #include "utils.h"
 
 #define UNUSED(x) ((void)(x))
 
+/* the form's layout is fixed: eight fields and the terminating null */
+#define SCREEN_FIELDS 9
+
+/* the keys whose sequences are taken from terminfo */
+static const struct {
+        const char *cap;
+        int key;
+} key_caps[] = {
+        { "kf1", UI_KEY_F1 },     { "kf2", UI_KEY_F2 },
+        { "kcub1", UI_KEY_LEFT }, { "kcuf1", UI_KEY_RIGHT },
+        { "kdch1", UI_KEY_DELETE },
+};
+
+#define KEY_CAPS (sizeof key_caps / sizeof *key_caps)
+
+/*
+ * Keys are not read with getch(), which reads a byte at a time and
+ * refreshes the screen on every call, but by the input stage, with the
+ * terminal's sequences from terminfo.
+ */
+struct term_t {
+        SCREEN *sp;
+        FILE *out;
+        int left;
+
+        struct input_t input;
+        struct input_seq_t seqs[KEY_CAPS];
+};
+
+struct screen_t {
+        FORM *form;
+        FIELD *fields[SCREEN_FIELDS];
+        WINDOW *win, *sub;
+        int serial;
+};
+
+/* where the fields of UI_STARTUP, UI_LOGIN and UI_PASSWORD are */
+static const int field_slots[] = { 1, 3, 5 };
+
 static const int box_width   = 40;
 static const int box_height  = 11;
 static const int box_padding =  1;
 
-static const int nfields = 9;
-
 static char *hostname(char *buf, size_t len)
 {
         struct utsname utsname;
@@ -78,8 +118,11 @@ static FIELD *make_passwd_field()
 {
         FIELD *pf = make_field(1, 1, 7, 14, 0);
 
-        if (pf)
+        /* no longer than the arena slot it goes to */
+        if (pf) {
                 field_opts_off(pf, O_PUBLIC);
+                set_max_field(pf, SECRET_SIZE - 1);
+        }
 
         return pf;
 }
@@ -88,30 +131,14 @@ static FIELD *make_startup_field(char **labels)
 {
         FIELD *pf;
 
-        const char *buf[16], **pbuf = buf;
-        size_t i, n, buflen = sizeof buf / sizeof *buf;
-
-        for (n = 0; labels[n]; ++n) ;
-        if (n + 1 > buflen) {
-                pbuf = malloc((n + 1) * sizeof *buf);
-                if (0 == pbuf)
-                        return 0;
-        }
-
         pf = make_field(1, 10, 3, 15, 0);
         if (pf) {
                 field_opts_off(pf, O_EDIT);
 
-                for (i = 0; i < n; ++i)
-                        pbuf[i] = labels[i];
-
-                pbuf[i] = 0;
-                set_field_type(pf, TYPE_ENUM, pbuf, 0, 0);
+                /* the field type keeps its own copy of the labels */
+                set_field_type(pf, TYPE_ENUM, labels, 0, 0);
         }
 
-        if (pbuf != buf)
-                free(pbuf);
-
         return pf;
 }
 
@@ -148,18 +175,14 @@ static FIELD *make_host_label()
 
 static void free_fields(FIELD **pptr, FIELD **ppend)
 {
-        for (; pptr != ppend; ++pptr)
-                free(*pptr);
+        for (; pptr != ppend; ++pptr) {
+                if (*pptr)
+                        free_field(*pptr);
+        }
 }
 
-static FIELD **make_fields(char **labels)
+static int make_fields(FIELD **fields, char **labels)
 {
-        FIELD **fields = (FIELD **)malloc(nfields * sizeof(FIELD *));
-        if (0 == fields)
-                return 0;
-
-        memset(fields, 0, nfields * sizeof(FIELD *));
-
         fields[0] = make_host_label();
         fields[1] = make_startup_field(labels);
 
@@ -177,12 +200,12 @@ static FIELD **make_fields(char **labels)
         if (0 == fields[0] || 0 == fields[1] || 0 == fields[2] ||
             0 == fields[3] || 0 == fields[4] || 0 == fields[5] ||
             0 == fields[6] || 0 == fields[7]) {
-                free_fields(fields, fields + nfields);
-                free(fields);
-                return 0;
+                free_fields(fields, fields + SCREEN_FIELDS);
+                memset(fields, 0, SCREEN_FIELDS * sizeof *fields);
+                return 1;
         }
 
-        return fields;
+        return 0;
 }
 
 void free_screen(struct screen_t *screen)
@@ -195,8 +218,7 @@ void free_screen(struct screen_t *screen)
                         free_form(ptr);
                 }
 
-                free_fields(screen->fields, screen->fields + nfields);
-                free(screen->fields);
+                free_fields(screen->fields, screen->fields + SCREEN_FIELDS);
 
                 if (screen->sub)
                         delwin(screen->sub);
@@ -208,25 +230,81 @@ void free_screen(struct screen_t *screen)
         }
 }
 
+void draw_message(struct screen_t *screen, const char *msg)
+{
+        int w, y, n;
+
+        if (screen) {
+                w = box_width - 2 * box_padding;
+                y = box_height - 2 * box_padding - 1;
+
+                n = strlen(msg);
+                if (n > w)
+                        n = w;
+
+                wmove(screen->sub, y, 0);
+                wclrtoeol(screen->sub);
+
+                mvwaddnstr(screen->sub, y, (w - n) / 2, msg, n);
+                wnoutrefresh(screen->sub);
+        }
+}
+
+/*
+ * Paints everything, header and box included, for when the terminal holds
+ * nothing we know of: when the screen is first shown and after a session.
+ * Nothing is sent until update_screen(). A serial line gets the fields
+ * alone, without the box and its line-drawing characters.
+ */
 void draw_screen(struct screen_t *screen)
 {
         if (screen) {
-                mvprintw(0, 0, "F1 reboot  F2 shutdown");
-                mvprintw(LINES - 1, 1, "C-c Reset screen");
-                refresh();
+                if (!screen->serial) {
+                        mvprintw(0, 0, "F1 reboot  F2 shutdown");
+                        mvprintw(LINES - 1, 1, "C-c Reset screen");
+                        box(screen->win, 0, 0);
+                }
+
+                clearok(curscr, TRUE);
+
+                wnoutrefresh(stdscr);
+                wnoutrefresh(screen->win);
+                wnoutrefresh(screen->sub);
+        }
+}
 
-                box(screen->win, 0, 0);
+/*
+ * Sends the terminal what has changed since the last update, in one go: an
+ * input event, however many keys it has brought, costs a single doupdate().
+ */
+void update_screen(struct screen_t *screen)
+{
+        if (screen) {
+                pos_form_cursor(screen->form);
+                wnoutrefresh(screen->win);
+                doupdate();
 
-                wrefresh(screen->win);
-                wrefresh(screen->sub);
+                metrics_add(METRIC_REDRAWS, 1);
         }
 }
 
-int init_screen()
+/*
+ * While a login is being authenticated the only thing that changes is the
+ * message, so the cursor is hidden and left there instead of being walked
+ * back to the form on every update.
+ */
+void busy_screen(struct screen_t *screen, int busy)
 {
-        initscr();
-        atexit((void(*)(void))endwin);
+        if (screen) {
+                curs_set(busy ? 0 : 1);
+
+                leaveok(screen->win, busy);
+                leaveok(screen->sub, busy);
+        }
+}
 
+static int setup_screen()
+{
         noecho();
         cbreak();
 
@@ -241,21 +319,219 @@ int init_screen()
         return 0;
 }
 
+/*
+ * Bracketed paste, which curses knows nothing of, straight to the terminal:
+ * curses has flushed all it had at the end of the last update.
+ */
+static void
+paste_mode(struct term_t *term, int on)
+{
+        fputs(on ? "\033[?2004h" : "\033[?2004l", term->out);
+        fflush(term->out);
+}
+
+struct term_t *init_term(FILE *out, FILE *in)
+{
+        struct term_t *term;
+        const char *name, *seq;
+        size_t i;
+
+        name = getenv("TERM");
+        if (0 == name || 0 == name[0])
+                name = "linux";
+
+        if (0 == (term = calloc(1, sizeof *term)))
+                return 0;
+
+        term->sp = newterm(name, out, in);
+        if (0 == term->sp) {
+                fprintf(stderr, "failed to initialize terminal\n");
+                free(term);
+                return 0;
+        }
+
+        if (setup_screen()) {
+                endwin();
+                delscreen(term->sp);
+                free(term);
+                return 0;
+        }
+
+        term->out = out;
+        paste_mode(term, 1);
+
+        input_init(&term->input, fileno(in));
+        term->input.seqs = term->seqs;
+
+        for (i = 0; i < KEY_CAPS; ++i) {
+                seq = tigetstr(key_caps[i].cap);
+
+                if (0 == seq || (char *)-1 == seq || 27 != *seq)
+                        continue;
+
+                term->seqs[term->input.nseqs].seq = seq;
+                term->seqs[term->input.nseqs++].key = key_caps[i].key;
+        }
+
+        return term;
+}
+
+void free_term(struct term_t *term)
+{
+        if (term) {
+                set_term(term->sp);
+                paste_mode(term, 0);
+                endwin();
+                delscreen(term->sp);
+                free(term);
+        }
+}
+
+void select_term(struct term_t *term)
+{
+        set_term(term->sp);
+
+        if (term->left) {
+                paste_mode(term, 1);
+                term->left = 0;
+        }
+}
+
+/* hands the terminal over, to a session or to reboot */
+void leave_term(struct term_t *term)
+{
+        set_term(term->sp);
+        paste_mode(term, 0);
+        endwin();
+
+        term->left = 1;
+}
+
+int term_baudrate(struct term_t *term)
+{
+        set_term(term->sp);
+        return baudrate();
+}
+
+int read_key(struct term_t *term)
+{
+        return input_key(&term->input);
+}
+
+void drop_keys(struct term_t *term)
+{
+        input_wipe(&term->input);
+}
+
+/*
+ * Feeds a key to the form. Returns 1 when the user has submitted the form,
+ * in which case the caller reads the fields back.
+ */
+int feed_key(struct screen_t *screen, int c)
+{
+        FORM *f = screen->form;
+        FIELD **fs = screen->fields;
+
+        switch (c) {
+        case UI_KEY_ENTER:
+                return 1;
+
+        case '\t':
+                form_driver(f, REQ_NEXT_FIELD);
+                form_driver(f, REQ_END_FIELD);
+                break;
+
+        case UI_KEY_LEFT:
+                if (fs[1] == current_field(f)) {
+                        form_driver(f, REQ_PREV_CHOICE);
+                }
+                else {
+                        form_driver(f, REQ_PREV_CHAR);
+                }
+                break;
+
+        case UI_KEY_RIGHT:
+                if (fs[1] == current_field(f)) {
+                        form_driver(f, REQ_NEXT_CHOICE);
+                }
+                else {
+                        form_driver(f, REQ_NEXT_CHAR);
+                }
+                break;
+
+        case UI_KEY_BACKSPACE:
+                /* Delete the char before cursor */
+                form_driver(f, REQ_DEL_PREV);
+                break;
+
+        case UI_KEY_DELETE:
+                /* Delete the char under the cursor */
+                form_driver(f, REQ_DEL_CHAR);
+                break;
+
+        default:
+                if (c < UI_KEY_F1)
+                        form_driver(f, c);
+                break;
+        }
+
+        return 0;
+}
+
+/* the field's buffer, blank-padded, as of the last key */
+const char *field_text(struct screen_t *screen, int field)
+{
+        form_driver(screen->form, REQ_VALIDATION);
+
+        return field_buffer(screen->fields[field_slots[field]], 0);
+}
+
+void clear_field(struct screen_t *screen, int field)
+{
+        set_field_buffer(screen->fields[field_slots[field]], 0, "");
+}
+
+void focus_field(struct screen_t *screen, int field)
+{
+        set_current_field(screen->form, screen->fields[field_slots[field]]);
+}
+
+int focused_field(struct screen_t *screen)
+{
+        FIELD *f = current_field(screen->form);
+        int i;
+
+        for (i = UI_STARTUP; i <= UI_PASSWORD; ++i) {
+                if (f == screen->fields[field_slots[i]])
+                        return i;
+        }
+
+        return -1;
+}
+
+/*
+ * On a serial line the form is laid out line by line from the top left
+ * corner, where centering it would only cost cursor motion on every update.
+ */
 struct screen_t *
-make_screen(char **labels)
+make_screen(char **labels, int serial)
 {
         struct screen_t *screen;
-        int x, y;
+        int x = 0, y = 0;
 
-        x = (float)( COLS - box_width)  / 2 + 1;
-        y = (float)(LINES - box_height) / 2 + 1;
+        if (!serial) {
+                x = (float)( COLS - box_width)  / 2 + 1;
+                y = (float)(LINES - box_height) / 2 + 1;
+        }
 
-        screen = (struct screen_t *)malloc(sizeof *screen);
+        screen = (struct screen_t *)calloc(1, sizeof *screen);
         if (0 == screen) {
                 fprintf(stderr, "failed to allocate screen\n");
                 goto err;
         }
 
+        screen->serial = serial;
+
         screen->win = newwin(box_height, box_width, y, x);
         if (0 == screen->win) {
                 fprintf(stderr, "failed to create window\n");
@@ -272,8 +548,7 @@ make_screen(char **labels)
                 goto err;
         }
 
-        screen->fields = make_fields(labels);
-        if (0 == screen->fields) {
+        if (make_fields(screen->fields, labels)) {
                 fprintf(stderr, "failed to create form fields\n");
                 goto err;
         }
@@ -288,7 +563,9 @@ make_screen(char **labels)
         set_form_sub(screen->form, screen->sub);
 
         post_form(screen->form);
-        draw_screen(screen);
+
+        /* the first entry is the default */
+        form_driver(screen->form, REQ_NEXT_CHOICE);
 
         return screen;
 
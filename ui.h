@@ -3,17 +3,60 @@
 #ifndef TUI_UI_H
 #define TUI_UI_H
 
-struct screen_t {
-        FORM *form;
-        FIELD **fields;
-        WINDOW *win, *sub;
+#include <stdio.h>
+
+/*
+ * The login box, as the rest of logitty sees it. There are two backends
+ * behind this: ui.c, on ncurses and its form library, and ui_vt100.c, which
+ * writes VT100/linux console sequences itself and reads keys in raw mode,
+ * for builds without ncurses (`make UI=vt100').
+ *
+ * A term_t is a terminal in curses mode, a screen_t the form on it. Calls
+ * that take neither act on the terminal last selected.
+ */
+struct term_t;
+struct screen_t;
+
+/* the fields that can be read back */
+enum { UI_STARTUP, UI_LOGIN, UI_PASSWORD };
+
+/* what read_key() returns besides plain characters */
+enum {
+        UI_KEY_NONE = -1,
+
+        UI_KEY_F1 = 0x100,
+        UI_KEY_F2,
+        UI_KEY_LEFT,
+        UI_KEY_RIGHT,
+        UI_KEY_BACKSPACE,
+        UI_KEY_DELETE,
+        UI_KEY_ENTER
 };
 
-int init_screen();
+struct term_t *init_term(FILE *out, FILE *in);
+void free_term(struct term_t *term);
+
+void select_term(struct term_t *term);
+void leave_term(struct term_t *term);
+int term_baudrate(struct term_t *term);
 
-struct screen_t *make_screen(char **labels);
+int read_key(struct term_t *term);
+void drop_keys(struct term_t *term);
+
+struct screen_t *make_screen(char **labels, int serial);
 void free_screen(struct screen_t *screen);
 
+int feed_key(struct screen_t *screen, int c);
+
+const char *field_text(struct screen_t *screen, int field);
+void clear_field(struct screen_t *screen, int field);
+void focus_field(struct screen_t *screen, int field);
+int focused_field(struct screen_t *screen);
+
 void draw_screen(struct screen_t *screen);
+void draw_message(struct screen_t *screen, const char *msg);
+
+void update_screen(struct screen_t *screen);
+void busy_screen(struct screen_t *screen, int busy);
 
 #endif /* TUI_UI_H */
@@ -0,0 +1,671 @@
+/* -*- mode: c; -*- */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/utsname.h>
+
+#include "input.h"
+#include "metrics.h"
+#include "secret.h"
+#include "ui.h"
+
+/*
+ * The login box without ncurses: the same layout as ui.c, written out with
+ * the handful of VT100 sequences the linux console and any serial terminal
+ * understand, and keys read from the terminal in raw mode. What a key
+ * changes is written to a buffer and the buffer goes out in a single write
+ * on update_screen(); typing at the end of a field costs the character
+ * alone.
+ */
+static const int box_width   = 40;
+static const int box_height  = 11;
+static const int box_padding =  1;
+
+/* a password fills the arena slot it goes to at most */
+#define FIELD_SIZE SECRET_SIZE
+
+struct term_t {
+        int in, out;
+        struct termios saved, raw;
+        int lines, cols;
+        int left;
+
+        /* what goes out on the next update, and where the cursor is then */
+        char buf[4096];
+        size_t len;
+        int y, x;
+
+        struct input_t input;
+};
+
+struct field_t {
+        int y, x, w, visible;
+
+        char text[FIELD_SIZE];
+        int len, pos, start;
+};
+
+struct screen_t {
+        struct term_t *term;
+        int serial, busy;
+
+        /* the sub-window, inside the box */
+        int y, x;
+
+        char host[32];
+        char message[64];
+
+        const char **labels;
+        int nlabels, choice;
+
+        struct field_t fields[3];
+        int current;
+};
+
+static struct term_t *current_term;
+
+/**********************************************************************/
+
+static void
+flush(struct term_t *t)
+{
+        ssize_t n;
+        size_t off = 0;
+
+        if (t->left) {
+                tcsetattr(t->in, TCSADRAIN, &t->raw);
+                t->left = 0;
+        }
+
+        while (off < t->len) {
+                n = write(t->out, t->buf + off, t->len - off);
+                if (0 > n) {
+                        if (EINTR == errno)
+                                continue;
+                        break;
+                }
+
+                off += n;
+        }
+
+        metrics_add(METRIC_REDRAW_BYTES, off);
+        t->len = 0;
+}
+
+static void
+put(struct term_t *t, const char *s, size_t n)
+{
+        if (sizeof t->buf - t->len < n)
+                flush(t);
+
+        if (sizeof t->buf < n)
+                n = sizeof t->buf;
+
+        memcpy(t->buf + t->len, s, n);
+        t->len += n;
+}
+
+/* text that moves the cursor along, on one line */
+static void
+text(struct term_t *t, const char *s, size_t n)
+{
+        put(t, s, n);
+        t->x += n;
+}
+
+static void
+move_to(struct term_t *t, int y, int x)
+{
+        char seq[16];
+        int n;
+
+        if (y == t->y && x == t->x)
+                return;
+
+        if (y == t->y && x < t->x && t->x - x <= 3) {
+                for (; t->x != x; --t->x)
+                        put(t, "\b", 1);
+                return;
+        }
+
+        n = snprintf(seq, sizeof seq, "\033[%d;%dH", y + 1, x + 1);
+        put(t, seq, n);
+
+        t->y = y;
+        t->x = x;
+}
+
+static void
+text_at(struct term_t *t, int y, int x, const char *s)
+{
+        move_to(t, y, x);
+        text(t, s, strlen(s));
+}
+
+/**********************************************************************/
+
+static int
+term_size(struct term_t *t)
+{
+        struct winsize ws;
+
+        if (0 == ioctl(t->out, TIOCGWINSZ, &ws) && ws.ws_row && ws.ws_col) {
+                t->lines = ws.ws_row;
+                t->cols = ws.ws_col;
+        }
+        else {
+                t->lines = 24;
+                t->cols = 80;
+        }
+
+        if (box_height + 3 > t->lines || box_width > t->cols) {
+                fprintf(stderr, "screen too small (%d x %d)\n",
+                        t->cols, t->lines);
+                return 1;
+        }
+
+        return 0;
+}
+
+struct term_t *init_term(FILE *out, FILE *in)
+{
+        struct term_t *t;
+
+        if (0 == (t = calloc(1, sizeof *t)))
+                return 0;
+
+        t->in = fileno(in);
+        t->out = fileno(out);
+
+        input_init(&t->input, t->in);
+
+        if (tcgetattr(t->in, &t->saved)) {
+                fprintf(stderr, "failed to initialize terminal : %s\n",
+                        strerror(errno));
+                free(t);
+                return 0;
+        }
+
+        if (term_size(t)) {
+                free(t);
+                return 0;
+        }
+
+        /* keys as they come, without waiting; C-c still resets the screen */
+        t->raw = t->saved;
+        t->raw.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+        t->raw.c_iflag &= ~(ICRNL | INLCR | IGNCR | IXON);
+        t->raw.c_cc[VMIN] = 0;
+        t->raw.c_cc[VTIME] = 0;
+
+        if (tcsetattr(t->in, TCSADRAIN, &t->raw)) {
+                fprintf(stderr, "failed to initialize terminal : %s\n",
+                        strerror(errno));
+                free(t);
+                return 0;
+        }
+
+        current_term = t;
+
+        return t;
+}
+
+void leave_term(struct term_t *t)
+{
+        if (t->left)
+                return;
+
+        move_to(t, t->lines - 1, 0);
+        put(t, "\033[m\033[?25h\033[?2004l\r\n", 19);
+        flush(t);
+
+        tcsetattr(t->in, TCSADRAIN, &t->saved);
+
+        t->left = 1;
+        t->y = t->x = -1;
+}
+
+void free_term(struct term_t *t)
+{
+        if (t) {
+                leave_term(t);
+
+                if (current_term == t)
+                        current_term = 0;
+
+                free(t);
+        }
+}
+
+void select_term(struct term_t *t)
+{
+        current_term = t;
+}
+
+int term_baudrate(struct term_t *t)
+{
+        static const struct { speed_t code; int baud; } speeds[] = {
+                { B300, 300 }, { B1200, 1200 }, { B2400, 2400 },
+                { B4800, 4800 }, { B9600, 9600 }, { B19200, 19200 },
+                { B38400, 38400 }, { B57600, 57600 }, { B115200, 115200 },
+                { B230400, 230400 },
+        };
+
+        speed_t code = cfgetospeed(&t->saved);
+        size_t i;
+
+        for (i = 0; i < sizeof speeds / sizeof *speeds; ++i) {
+                if (code == speeds[i].code)
+                        return speeds[i].baud;
+        }
+
+        return 0;
+}
+
+/**********************************************************************/
+
+int read_key(struct term_t *t)
+{
+        return input_key(&t->input);
+}
+
+void drop_keys(struct term_t *t)
+{
+        input_wipe(&t->input);
+}
+
+/**********************************************************************/
+
+/* keeps the cursor in view, 1 if the field has scrolled for it */
+static int
+scroll_field(struct field_t *f)
+{
+        int start = f->start;
+
+        if (f->pos < f->start)
+                f->start = f->pos;
+        if (f->pos - f->start >= f->w)
+                f->start = f->pos - f->w + 1;
+
+        return start != f->start;
+}
+
+/*
+ * Writes what is in view of the field from index from on, followed by up
+ * to blanks blanks where characters have gone.
+ */
+static void
+draw_tail(struct screen_t *screen, struct field_t *f, int from, int blanks)
+{
+        struct term_t *t = screen->term;
+        int end = f->start + f->w, n;
+
+        if (!f->visible)
+                return;
+
+        if (from < f->start)
+                from = f->start;
+
+        n = (f->len < end ? f->len : end) - from;
+        if (0 > n)
+                n = 0;
+
+        move_to(t, screen->y + f->y, screen->x + f->x + from - f->start);
+        text(t, f->text + from, n);
+
+        for (from += n; blanks-- && from < end; ++from)
+                text(t, " ", 1);
+}
+
+static void
+draw_field(struct screen_t *screen, struct field_t *f)
+{
+        scroll_field(f);
+        draw_tail(screen, f, f->start, f->w);
+}
+
+static void
+set_choice(struct screen_t *screen, int choice)
+{
+        struct field_t *f = screen->fields + UI_STARTUP;
+
+        if (0 == screen->nlabels)
+                return;
+
+        screen->choice = (choice + screen->nlabels) % screen->nlabels;
+
+        snprintf(f->text, sizeof f->text, "%s",
+                 screen->labels[screen->choice]);
+        f->len = strlen(f->text);
+        f->pos = f->start = 0;
+}
+
+/* a key typed into a field, where the field allows it */
+static void
+insert_char(struct screen_t *screen, struct field_t *f, int c)
+{
+        if (UI_STARTUP == f - screen->fields || FIELD_SIZE - 1 <= f->len)
+                return;
+
+        memmove(f->text + f->pos + 1, f->text + f->pos, f->len - f->pos);
+        f->text[f->pos++] = c;
+        f->text[++f->len] = 0;
+
+        if (scroll_field(f))
+                draw_tail(screen, f, f->start, f->w);
+        else
+                draw_tail(screen, f, f->pos - 1, 0);
+}
+
+static void
+delete_char(struct screen_t *screen, struct field_t *f, int at)
+{
+        if (UI_STARTUP == f - screen->fields || at < 0 || at >= f->len)
+                return;
+
+        memmove(f->text + at, f->text + at + 1, f->len - at);
+        --f->len;
+
+        if (at < f->pos)
+                --f->pos;
+
+        if (scroll_field(f))
+                draw_tail(screen, f, f->start, f->w);
+        else
+                draw_tail(screen, f, at, 1);
+}
+
+/* the cursor has moved in the field, which only matters if it scrolls */
+static void
+move_cursor(struct screen_t *screen, struct field_t *f, int pos)
+{
+        f->pos = pos;
+
+        if (scroll_field(f))
+                draw_tail(screen, f, f->start, f->w);
+}
+
+int feed_key(struct screen_t *screen, int c)
+{
+        struct field_t *f = screen->fields + screen->current;
+
+        switch (c) {
+        case UI_KEY_ENTER:
+                return 1;
+
+        case '\t':
+                screen->current = (screen->current + 1) % 3;
+                f = screen->fields + screen->current;
+                move_cursor(screen, f, f->len);
+                break;
+
+        case UI_KEY_LEFT:
+                if (UI_STARTUP == screen->current) {
+                        set_choice(screen, screen->choice - 1);
+                        draw_field(screen, f);
+                }
+                else if (0 < f->pos)
+                        move_cursor(screen, f, f->pos - 1);
+                break;
+
+        case UI_KEY_RIGHT:
+                if (UI_STARTUP == screen->current) {
+                        set_choice(screen, screen->choice + 1);
+                        draw_field(screen, f);
+                }
+                else if (f->pos < f->len)
+                        move_cursor(screen, f, f->pos + 1);
+                break;
+
+        case UI_KEY_BACKSPACE:
+                delete_char(screen, f, f->pos - 1);
+                break;
+
+        case UI_KEY_DELETE:
+                delete_char(screen, f, f->pos);
+                break;
+
+        default:
+                if (32 <= c && 127 != c && c < UI_KEY_F1)
+                        insert_char(screen, f, c);
+                break;
+        }
+
+        return 0;
+}
+
+const char *field_text(struct screen_t *screen, int field)
+{
+        return screen->fields[field].text;
+}
+
+void clear_field(struct screen_t *screen, int field)
+{
+        struct field_t *f = screen->fields + field;
+
+        explicit_bzero(f->text, sizeof f->text);
+        f->len = f->pos = f->start = 0;
+
+        draw_field(screen, f);
+}
+
+void focus_field(struct screen_t *screen, int field)
+{
+        screen->current = field;
+}
+
+int focused_field(struct screen_t *screen)
+{
+        return screen->current;
+}
+
+/**********************************************************************/
+
+static void
+make_field(struct field_t *f, int y, int x, int w, int visible)
+{
+        f->y = y;
+        f->x = x;
+        f->w = w;
+        f->visible = visible;
+}
+
+struct screen_t *
+make_screen(char **labels, int serial)
+{
+        struct screen_t *screen;
+        struct utsname utsname;
+        int n;
+
+        screen = calloc(1, sizeof *screen);
+        if (0 == screen) {
+                fprintf(stderr, "failed to allocate screen\n");
+                return 0;
+        }
+
+        screen->term = current_term;
+        screen->serial = serial;
+
+        if (!serial) {
+                screen->y = (float)(current_term->lines - box_height) / 2 + 1;
+                screen->x = (float)(current_term->cols  - box_width)  / 2 + 1;
+        }
+
+        screen->y += box_padding;
+        screen->x += box_padding;
+
+        if (0 > uname(&utsname)) {
+                fprintf(stderr, "could not get host info\n");
+                goto err;
+        }
+
+        snprintf(screen->host, sizeof screen->host, "%.*s",
+                 (int)sizeof screen->host - 1, utsname.nodename);
+
+        for (n = 0; labels[n]; ++n) ;
+
+        screen->labels = malloc((n + 1) * sizeof *screen->labels);
+        if (0 == screen->labels) {
+                fprintf(stderr, "failed to create form fields\n");
+                goto err;
+        }
+
+        memcpy(screen->labels, labels, (n + 1) * sizeof *labels);
+        screen->nlabels = n;
+
+        make_field(screen->fields + UI_STARTUP,  3, 15, 10, 1);
+        make_field(screen->fields + UI_LOGIN,    5, 14, 14, 1);
+        make_field(screen->fields + UI_PASSWORD, 7, 14,  1, 0);
+
+        /* the first entry is the default */
+        set_choice(screen, 0);
+
+        return screen;
+
+err:
+        free_screen(screen);
+        return 0;
+}
+
+void free_screen(struct screen_t *screen)
+{
+        if (screen) {
+                explicit_bzero(screen->fields, sizeof screen->fields);
+
+                free(screen->labels);
+                free(screen);
+        }
+}
+
+static void
+draw_box(struct term_t *t, int y, int x)
+{
+        char line[64];
+        int i;
+
+        put(t, "\033(0", 3);
+
+        memset(line, 'q', box_width);
+        line[0] = 'l';
+        line[box_width - 1] = 'k';
+        move_to(t, y, x);
+        text(t, line, box_width);
+
+        for (i = 1; i < box_height - 1; ++i) {
+                text_at(t, y + i, x, "x");
+                text_at(t, y + i, x + box_width - 1, "x");
+        }
+
+        line[0] = 'm';
+        line[box_width - 1] = 'j';
+        move_to(t, y + box_height - 1, x);
+        text(t, line, box_width);
+
+        put(t, "\033(B", 3);
+}
+
+/*
+ * Paints everything, header and box included, for when the terminal holds
+ * nothing we know of. A serial line gets the fields alone.
+ */
+void draw_screen(struct screen_t *screen)
+{
+        struct term_t *t = screen->term;
+        int i, n;
+
+        /* pastes come bracketed, to be told apart from typing */
+        put(t, "\033[?2004h\033[m\033[H\033[2J", 18);
+        t->y = t->x = 0;
+
+        if (!screen->serial) {
+                text_at(t, 0, 0, "F1 reboot  F2 shutdown");
+                text_at(t, t->lines - 1, 1, "C-c Reset screen");
+
+                draw_box(t, screen->y - box_padding, screen->x - box_padding);
+        }
+
+        n = strlen(screen->host);
+        text_at(t, screen->y + 1, screen->x + (box_width - n) / 2 - 1,
+                screen->host);
+
+        text_at(t, screen->y + 3, screen->x + 13, "<");
+        text_at(t, screen->y + 3, screen->x + 27, ">");
+        text_at(t, screen->y + 5, screen->x + 3, "login    : ");
+        text_at(t, screen->y + 7, screen->x + 3, "password : ");
+
+        /* on a cleared screen, without the blanks */
+        for (i = 0; i < 3; ++i) {
+                scroll_field(screen->fields + i);
+                draw_tail(screen, screen->fields + i,
+                          screen->fields[i].start, 0);
+        }
+
+        if (screen->message[0]) {
+                n = strlen(screen->message);
+                text_at(t, screen->y + box_height - 2 * box_padding - 1,
+                        screen->x + (box_width - 2 * box_padding - n) / 2,
+                        screen->message);
+        }
+}
+
+static void
+message_line(char *line, int w, const char *msg)
+{
+        int n = strlen(msg);
+
+        memset(line, ' ', w);
+        memcpy(line + (w - n) / 2, msg, n);
+}
+
+/* only what differs from the previous message is written */
+void draw_message(struct screen_t *screen, const char *msg)
+{
+        struct term_t *t = screen->term;
+        char line[64], old[64];
+        int w, y, from, to;
+
+        w = box_width - 2 * box_padding;
+        y = screen->y + box_height - 2 * box_padding - 1;
+
+        message_line(old, w, screen->message);
+
+        snprintf(screen->message, w + 1, "%s", msg);
+        message_line(line, w, screen->message);
+
+        for (from = 0; from < w && line[from] == old[from]; ++from) ;
+        for (to = w; to > from && line[to - 1] == old[to - 1]; --to) ;
+
+        if (from < to) {
+                move_to(t, y, screen->x + from);
+                text(t, line + from, to - from);
+        }
+}
+
+void update_screen(struct screen_t *screen)
+{
+        struct term_t *t = screen->term;
+        struct field_t *f = screen->fields + screen->current;
+
+        if (!screen->busy) {
+                move_to(t, screen->y + f->y, screen->x + f->x +
+                        (f->visible ? f->pos - f->start : 0));
+        }
+
+        flush(t);
+        metrics_add(METRIC_REDRAWS, 1);
+}
+
+void busy_screen(struct screen_t *screen, int busy)
+{
+        screen->busy = busy;
+
+        /* not every serial terminal knows how to hide the cursor */
+        if (!screen->serial)
+                put(screen->term, busy ? "\033[?25l" : "\033[?25h", 6);
+}
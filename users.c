@@ -0,0 +1,264 @@
+/* -*- mode: c; -*- */
+
+#include <errno.h>
+#include <grp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "users.h"
+
+/*
+ * The table is shared: the resolver fills an entry in, and the worker forked
+ * later for the login finds it there. An entry being looked up is PENDING,
+ * and taken as lost once it has been so for ttl seconds. gen is a seqlock
+ * count: odd from when the entry is given to a lookup until the resolver is
+ * done writing it, so that a worker can tell an entry it has copied has
+ * changed under it.
+ */
+#define USERS_SIZE 32
+
+enum { ENTRY_FREE, ENTRY_PENDING, ENTRY_READY };
+
+struct entry_t {
+        char username[32];
+        int state;
+        unsigned gen;
+
+        pid_t pid;
+        time_t since, expires;
+
+        struct user_t user;
+};
+
+static struct entry_t *entries;
+static int users_ttl;
+
+static time_t
+now()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_BOOTTIME, &ts);
+
+        return ts.tv_sec;
+}
+
+static int
+state(struct entry_t *e)
+{
+        return __atomic_load_n(&e->state, __ATOMIC_ACQUIRE);
+}
+
+static void
+set_state(struct entry_t *e, int state)
+{
+        __atomic_store_n(&e->state, state, __ATOMIC_RELEASE);
+}
+
+/* the strings are copied along, 1 if they do not fit */
+static int
+copy_passwd(struct user_t *u, const struct passwd *pw)
+{
+        if (sizeof u->name <= strlen(pw->pw_name) ||
+            sizeof u->dir <= strlen(pw->pw_dir) ||
+            sizeof u->shell <= strlen(pw->pw_shell))
+                return 1;
+
+        strcpy(u->name, pw->pw_name);
+        strcpy(u->dir, pw->pw_dir);
+        strcpy(u->shell, pw->pw_shell);
+
+        u->pw.pw_uid = pw->pw_uid;
+        u->pw.pw_gid = pw->pw_gid;
+
+        return 0;
+}
+
+static void
+point_passwd(struct user_t *u)
+{
+        u->pw.pw_name = u->name;
+        u->pw.pw_passwd = "x";
+        u->pw.pw_gecos = "";
+        u->pw.pw_dir = u->dir;
+        u->pw.pw_shell = u->shell;
+}
+
+/* the writes to an entry are over */
+static void
+unlock(struct entry_t *e, int state)
+{
+        __atomic_add_fetch(&e->gen, 1, __ATOMIC_RELEASE);
+        set_state(e, state);
+}
+
+/* in the resolver */
+static void
+resolve(struct entry_t *e)
+{
+        struct passwd *pw;
+        int n = USERS_GROUPS;
+
+        pw = getpwnam(e->username);
+        if (0 == pw || 0 == pw->pw_shell || 0 == *pw->pw_shell ||
+            copy_passwd(&e->user, pw) ||
+            -1 == getgrouplist(e->username, pw->pw_gid, e->user.groups, &n)) {
+                unlock(e, ENTRY_FREE);
+                _exit(1);
+        }
+
+        e->user.ngroups = n;
+        e->expires = now() + users_ttl;
+
+        unlock(e, ENTRY_READY);
+        _exit(0);
+}
+
+/* the entry of username, or the one to give it */
+static struct entry_t *
+choose(const char *username, time_t t)
+{
+        struct entry_t *e, *best = 0;
+
+        for (e = entries; e < entries + USERS_SIZE; ++e) {
+                if (ENTRY_FREE != state(e) &&
+                    0 == strcmp(e->username, username))
+                        return e;
+        }
+
+        for (e = entries; e < entries + USERS_SIZE; ++e) {
+                switch (state(e)) {
+                case ENTRY_FREE:
+                        return e;
+
+                case ENTRY_PENDING:
+                        if (e->since + users_ttl > t)
+                                continue;
+                        break;
+                }
+
+                if (0 == best || e->since < best->since)
+                        best = e;
+        }
+
+        return best;
+}
+
+/**********************************************************************/
+
+int users_setup(int ttl)
+{
+        void *p;
+
+        p = mmap(0, USERS_SIZE * sizeof *entries, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == p) {
+                fprintf(stderr, "user cache : %s\n", strerror(errno));
+                return 1;
+        }
+
+        entries = p;
+        users_ttl = ttl;
+
+        return 0;
+}
+
+/* starts a lookup of username, unless one is under way or still fresh */
+void users_resolve(const char *username)
+{
+        struct entry_t *e;
+        time_t t = now();
+        pid_t pid;
+
+        if (0 == entries || 0 == *username ||
+            sizeof e->username <= strlen(username))
+                return;
+
+        if (0 == (e = choose(username, t)))
+                return;
+
+        switch (state(e)) {
+        case ENTRY_READY:
+                if (e->expires > t && 0 == strcmp(e->username, username))
+                        return;
+                break;
+
+        case ENTRY_PENDING:
+                if (e->since + users_ttl > t)
+                        return;
+
+                /* lost on some unreachable server */
+                if (e->pid)
+                        kill(e->pid, SIGKILL);
+                break;
+        }
+
+        /* odd, even if a lost resolver has left it so */
+        __atomic_store_n(&e->gen, (e->gen + 1) | 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        strcpy(e->username, username);
+        e->since = t;
+        set_state(e, ENTRY_PENDING);
+
+        pid = fork();
+        if (0 == pid)
+                resolve(e);
+
+        if (0 > pid) {
+                fprintf(stderr, "fork : %s\n", strerror(errno));
+                unlock(e, ENTRY_FREE);
+                return;
+        }
+
+        e->pid = pid;
+}
+
+/* the resolver is not to be killed once its pid is free again */
+void users_reaped(pid_t pid)
+{
+        struct entry_t *e;
+
+        if (0 == entries || 0 >= pid)
+                return;
+
+        for (e = entries; e < entries + USERS_SIZE; ++e) {
+                if (pid == e->pid)
+                        e->pid = 0;
+        }
+}
+
+int users_find(const char *username, struct user_t *u)
+{
+        struct entry_t *e;
+        unsigned gen;
+
+        if (0 == entries)
+                return 1;
+
+        for (e = entries; e < entries + USERS_SIZE; ++e) {
+                gen = __atomic_load_n(&e->gen, __ATOMIC_ACQUIRE);
+
+                if ((gen & 1) || ENTRY_READY != state(e) ||
+                    e->expires <= now() || strcmp(e->username, username))
+                        continue;
+
+                memcpy(u, &e->user, sizeof *u);
+
+                /* given to another lookup while we were copying it */
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (gen != __atomic_load_n(&e->gen, __ATOMIC_RELAXED))
+                        return 1;
+
+                point_passwd(u);
+
+                return 0;
+        }
+
+        return 1;
+}
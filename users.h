@@ -0,0 +1,33 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_USERS_H
+#define TUI_USERS_H
+
+#include <pwd.h>
+#include <sys/types.h>
+
+/*
+ * The passwd entry and group list of a user, looked up ahead of the login:
+ * as soon as the username has been typed, a resolver child goes through
+ * NSS while the password is being typed, and leaves the result in a table
+ * shared with the worker that runs the login. Entries are kept ttl seconds.
+ */
+#define USERS_TTL    30
+#define USERS_GROUPS 256
+
+struct user_t {
+        struct passwd pw;
+        char name[32], dir[256], shell[256];
+
+        gid_t groups[USERS_GROUPS];
+        int ngroups;
+};
+
+int users_setup(int ttl);
+void users_resolve(const char *username);
+void users_reaped(pid_t pid);
+
+/* in the worker: 0 if the user is known, with u filled in */
+int users_find(const char *username, struct user_t *u);
+
+#endif /* TUI_USERS_H */
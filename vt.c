@@ -0,0 +1,154 @@
+/* -*- mode: c; -*- */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/major.h>
+#include <linux/serial.h>
+#include <linux/vt.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "utils.h"
+#include "vt.h"
+
+/*
+ * Opens a virtual terminal given as `tty2', `/dev/tty2' or `2' and checks
+ * that it is really a console. The descriptor does not become our
+ * controlling terminal, that is left to the session child (vt_claim).
+ */
+int vt_open(const char *tty)
+{
+        char buf[64], *pbuf;
+        struct vt_stat vts;
+        int fd;
+
+        if ('/' == tty[0])
+                pbuf = snprintf_(buf, sizeof buf, "%s", tty);
+        else if ('0' <= tty[0] && tty[0] <= '9')
+                pbuf = snprintf_(buf, sizeof buf, "/dev/tty%s", tty);
+        else
+                pbuf = snprintf_(buf, sizeof buf, "/dev/%s", tty);
+
+        if (0 == pbuf)
+                return -1;
+
+        fd = open(pbuf, O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (0 > fd)
+                fprintf(stderr, "open %s : %s\n", pbuf, strerror(errno));
+        else if (ioctl(fd, VT_GETSTATE, &vts)) {
+                fprintf(stderr, "%s is not a virtual terminal\n", pbuf);
+                close(fd);
+                fd = -1;
+        }
+
+        if (pbuf != buf)
+                free(pbuf);
+
+        return fd;
+}
+
+/*
+ * Makes the terminal the controlling terminal, stdin and stdout of the
+ * calling process, which must be a freshly forked child. stderr is left
+ * alone so that diagnostics keep going to the log until the session is
+ * exec'd.
+ */
+int vt_claim(int fd)
+{
+        if (0 > setsid() || ioctl(fd, TIOCSCTTY, 1)) {
+                fprintf(stderr, "failed to claim terminal : %s\n",
+                        strerror(errno));
+                return 1;
+        }
+
+        if (0 > dup2(fd, STDIN_FILENO) || 0 > dup2(fd, STDOUT_FILENO)) {
+                fprintf(stderr, "dup2 : %s\n", strerror(errno));
+                return 1;
+        }
+
+        return 0;
+}
+
+/*
+ * Tells a serial line, as agetty hands it to us, from a console or a
+ * pseudo-terminal: only serial drivers answer TIOCGSERIAL.
+ */
+int vt_serial(int fd)
+{
+        struct serial_struct ss;
+
+        return 0 == ioctl(fd, TIOCGSERIAL, &ss);
+}
+
+/* the number of the virtual terminal open on fd, 0 if it is not one */
+int vt_number(int fd)
+{
+        struct stat st;
+
+        if (fstat(fd, &st) || TTY_MAJOR != major(st.st_rdev))
+                return 0;
+
+        return minor(st.st_rdev);
+}
+
+/*
+ * Opens the first virtual terminal nobody has open, for a session of its
+ * own. fd is any console. Returns the descriptor, its number in *num.
+ */
+int vt_alloc(int fd, int *num)
+{
+        char buf[32];
+        int vtfd;
+
+        if (ioctl(fd, VT_OPENQRY, num) || 0 >= *num) {
+                fprintf(stderr, "no free virtual terminal\n");
+                return -1;
+        }
+
+        snprintf(buf, sizeof buf, "/dev/tty%d", *num);
+
+        vtfd = open(buf, O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (0 > vtfd)
+                fprintf(stderr, "open %s : %s\n", buf, strerror(errno));
+
+        return vtfd;
+}
+
+/* frees a virtual terminal once nobody has it open anymore */
+void vt_release(int fd, int num)
+{
+        ioctl(fd, VT_DISALLOCATE, num);
+}
+
+/*
+ * Brings virtual terminal num to the front; with wait, returns only once it
+ * is there, which a session starting on it needs and the greeter cannot
+ * afford.
+ */
+int vt_activate(int fd, int num, int wait)
+{
+        if (ioctl(fd, VT_ACTIVATE, num) ||
+            (wait && ioctl(fd, VT_WAITACTIVE, num))) {
+                fprintf(stderr, "activate tty%d : %s\n", num, strerror(errno));
+                return 1;
+        }
+
+        return 0;
+}
+
+/* the number of the virtual terminal in front */
+int vt_active(int fd)
+{
+        struct vt_stat vts;
+
+        if (ioctl(fd, VT_GETSTATE, &vts))
+                return 0;
+
+        return vts.v_active;
+}
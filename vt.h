@@ -0,0 +1,18 @@
+/* -*- mode: c; -*- */
+
+#ifndef TUI_VT_H
+#define TUI_VT_H
+
+int vt_open(const char *tty);
+int vt_claim(int fd);
+
+int vt_serial(int fd);
+
+int vt_number(int fd);
+int vt_alloc(int fd, int *num);
+void vt_release(int fd, int num);
+
+int vt_activate(int fd, int num, int wait);
+int vt_active(int fd);
+
+#endif /* TUI_VT_H */